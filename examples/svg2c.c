@@ -0,0 +1,125 @@
+#include <plutosvg.h>
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    size_t capacity;
+    int failed;
+} buffer_t;
+
+static void write_func(void* closure, void* data, int size)
+{
+    buffer_t* buffer = closure;
+    if(buffer->size + size > buffer->capacity) {
+        size_t capacity = buffer->size + size;
+        unsigned char* newdata = realloc(buffer->data, capacity);
+        if(newdata == NULL) {
+            buffer->failed = 1;
+            return;
+        }
+
+        buffer->data = newdata;
+        buffer->capacity = capacity;
+    }
+
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+static int is_identifier(const char* name)
+{
+    if(!isalpha((unsigned char)(*name)) && *name != '_')
+        return 0;
+    while(*++name) {
+        if(!isalnum((unsigned char)(*name)) && *name != '_') {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Writes the compiled form of the document as a byte table and a `name_load()` function that loads it with
+ * plutosvg_document_load_compiled_from_data(). Loading skips the XML parser and reads attribute values and
+ * ids from the table, but still allocates the document and rebuilds its element array and path geometry.
+ */
+static int write_source(FILE* stream, const char* input, const char* name, const buffer_t* buffer)
+{
+    fprintf(stream, "/* Generated by svg2c from '%s'. Do not edit. */\n\n", input);
+    fprintf(stream, "/*\n");
+    fprintf(stream, " * The table holds the document in the little-endian compiled format, so it can be generated on any\n");
+    fprintf(stream, " * host. %s_load() builds the document's element array and path geometry from it; attribute values\n", name);
+    fprintf(stream, " * and ids are used in place.\n");
+    fprintf(stream, " */\n\n");
+    fprintf(stream, "#include <plutosvg.h>\n\n");
+    fprintf(stream, "static const union {\n");
+    fprintf(stream, "    unsigned char bytes[%lu];\n", (unsigned long)(buffer->size));
+    fprintf(stream, "    unsigned int align;\n");
+    fprintf(stream, "} %s_data = {{", name);
+    for(size_t i = 0; i < buffer->size; ++i) {
+        if(i % 12 == 0)
+            fprintf(stream, "\n   ");
+        fprintf(stream, " 0x%02x,", buffer->data[i]);
+    }
+
+    fprintf(stream, "\n}};\n\n");
+    fprintf(stream, "plutosvg_document_t* %s_load(float width, float height)\n", name);
+    fprintf(stream, "{\n");
+    fprintf(stream, "    return plutosvg_document_load_compiled_from_data(%s_data.bytes, sizeof(%s_data.bytes), width, height,\n", name, name);
+    fprintf(stream, "        PLUTOSVG_LOAD_FLAGS_NONE, NULL, NULL);\n");
+    fprintf(stream, "}\n");
+    return !ferror(stream);
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc != 4) {
+        fprintf(stderr, "Usage: svg2c input output name\n");
+        fprintf(stderr, "Embeds the compiled form of input in a C source file that defines name_load()\n");
+        return -1;
+    }
+
+    const char* input = argv[1];
+    const char* output = argv[2];
+    const char* name = argv[3];
+    if(!is_identifier(name)) {
+        fprintf(stderr, "Invalid name '%s'\n", name);
+        return -1;
+    }
+
+    int status = -1;
+    buffer_t buffer = {NULL, 0, 0, 0};
+    FILE* stream = NULL;
+
+    plutosvg_document_t* document = plutosvg_document_load_from_file(input, -1, -1);
+    if(document == NULL) {
+        fprintf(stderr, "Unable to load '%s'\n", input);
+        goto cleanup;
+    }
+
+    if(!plutosvg_document_write_compiled(document, write_func, &buffer) || buffer.failed) {
+        fprintf(stderr, "Unable to compile '%s'\n", input);
+        goto cleanup;
+    }
+
+    stream = fopen(output, "w");
+    if(stream == NULL || !write_source(stream, input, name, &buffer)) {
+        fprintf(stderr, "Unable to write '%s'\n", output);
+        goto cleanup;
+    }
+
+    status = 0;
+
+cleanup:
+    if(stream && fclose(stream) != 0)
+        status = -1;
+    free(buffer.data);
+    plutosvg_document_destroy(document);
+    return status;
+}
@@ -0,0 +1,341 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <plutosvg.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_THREADS 64
+
+#define DOCUMENT_COUNT 4
+
+/*
+ * Replaying a display list under a transform multiplies the matrices in another order than a direct render,
+ * so the two may differ by rounding there.
+ */
+#define REPLAY_TOLERANCE 2
+
+typedef struct {
+    const plutosvg_document_t* document;
+    const plutovg_surface_t* references[2];
+    int iterations;
+    int failures;
+    pthread_t thread;
+} worker_t;
+
+static plutovg_surface_t* render_document(const plutosvg_document_t* document, bool replay, bool transformed)
+{
+    int width = (int)(plutosvg_document_get_width(document) + 0.5f);
+    int height = (int)(plutosvg_document_get_height(document) + 0.5f);
+    plutovg_surface_t* surface = plutovg_surface_create(width, height);
+    if(surface == NULL)
+        return NULL;
+    plutovg_canvas_t* canvas = plutovg_canvas_create(surface);
+    if(transformed) {
+        plutovg_matrix_t matrix;
+        plutovg_matrix_init(&matrix, 0.7f, 0.2f, -0.15f, 0.6f, width * 0.2f, height * 0.1f);
+        plutovg_canvas_transform(canvas, &matrix);
+    }
+
+    if(replay) {
+        plutosvg_display_list_t* list = plutosvg_document_compile(document, NULL, NULL);
+        if(list)
+            plutosvg_display_list_render(list, canvas);
+        plutosvg_display_list_destroy(list);
+    } else {
+        plutosvg_document_render(document, NULL, canvas, NULL, NULL, NULL);
+    }
+
+    plutovg_canvas_destroy(canvas);
+    return surface;
+}
+
+static bool compare_surfaces(const plutovg_surface_t* a, const plutovg_surface_t* b, int tolerance)
+{
+    int height = plutovg_surface_get_height(a);
+    int stride = plutovg_surface_get_stride(a);
+    if(b == NULL || height != plutovg_surface_get_height(b) || stride != plutovg_surface_get_stride(b))
+        return false;
+    const unsigned char* data_a = plutovg_surface_get_data(a);
+    const unsigned char* data_b = plutovg_surface_get_data(b);
+    size_t size = (size_t)(height) * stride;
+    if(tolerance == 0)
+        return memcmp(data_a, data_b, size) == 0;
+    for(size_t i = 0; i < size; ++i) {
+        if(abs(data_a[i] - data_b[i]) > tolerance) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static double elapsed_ms(const struct timespec* start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1000.0 + (end.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+/*
+ * Renders the document in bands on 2 up to `thread_count` threads and compares each result with a serial render.
+ */
+static int check_bands(const plutosvg_document_t* document, int thread_count)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    plutovg_surface_t* reference = plutosvg_document_render_to_surface(document, NULL, -1, -1, NULL, NULL, NULL);
+    if(reference == NULL)
+        return 1;
+    fprintf(stdout, "Rendered on 1 thread in %.2f ms\n", elapsed_ms(&start));
+
+    int failures = 0;
+    for(int threads = 2; threads <= thread_count; threads *= 2) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        plutovg_surface_t* surface = plutosvg_document_render_to_surface_with_threads(document, NULL, -1, -1, NULL, NULL, NULL, threads);
+        double duration = elapsed_ms(&start);
+        bool matches = compare_surfaces(reference, surface, 0);
+        fprintf(stdout, "Rendered on %d threads in %.2f ms: %s\n", threads, duration, matches ? "identical" : "MISMATCH");
+        if(!matches)
+            failures++;
+        plutovg_surface_destroy(surface);
+    }
+
+    plutovg_surface_destroy(reference);
+    return failures;
+}
+
+typedef struct {
+    char* data;
+    size_t size;
+    size_t capacity;
+    bool failed;
+} buffer_t;
+
+static void buffer_append(buffer_t* buffer, const void* data, size_t size)
+{
+    if(buffer->size + size > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+        while(capacity < buffer->size + size)
+            capacity *= 2;
+        char* newdata = realloc(buffer->data, capacity);
+        if(newdata == NULL) {
+            buffer->failed = true;
+            return;
+        }
+
+        buffer->data = newdata;
+        buffer->capacity = capacity;
+    }
+
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+static void buffer_printf(buffer_t* buffer, const char* format, int value)
+{
+    char text[256];
+    int length = snprintf(text, sizeof(text), format, value, value, value);
+    buffer_append(buffer, text, (size_t)(length));
+}
+
+static void buffer_write(void* closure, void* data, int size)
+{
+    buffer_append(closure, data, (size_t)(size));
+}
+
+/*
+ * Generates a document large enough to be split by a parallel load, with comments and text between the children
+ * of the root and ids that repeat across runs. When `malformed` is set, one child near the middle is left unclosed.
+ */
+static char* generate_document(size_t minimum_size, bool malformed, size_t* size)
+{
+    buffer_t buffer = {0};
+    static const char header[] = "<svg xmlns='http://www.w3.org/2000/svg' width='512' height='512' viewBox='0 0 512 512'>\n"
+        "<defs><linearGradient id='paint'><stop offset='0' stop-color='red'/><stop offset='1' stop-color='blue'/></linearGradient></defs>\n";
+    buffer_append(&buffer, header, sizeof(header) - 1);
+    int count = 0;
+    while(buffer.size < minimum_size && !buffer.failed) {
+        buffer_printf(&buffer, "<!-- child %d -->\n", count);
+        buffer_printf(&buffer, "<g id='group%d' transform='translate(%d 0)' fill='url(#paint)'>", count % 509);
+        buffer_printf(&buffer, "<rect id='shape' x='%d' y='%d' width='3' height='%d'/>", count % 512);
+        buffer_printf(&buffer, "<path id='path%d' d='M%d 0L%d 512' stroke='black'/>", count % 512);
+        if(malformed && buffer.size >= minimum_size / 2) {
+            malformed = false;
+        } else {
+            buffer_append(&buffer, "</g>\n", 5);
+        }
+
+        buffer_printf(&buffer, "<use href='#group%d' x='%d' y='%d'/>text\n", count % 509);
+        ++count;
+    }
+
+    buffer_append(&buffer, "</svg>\n", 7);
+    if(buffer.failed) {
+        free(buffer.data);
+        return NULL;
+    }
+
+    *size = buffer.size;
+    return buffer.data;
+}
+
+static bool write_document(const plutosvg_document_t* document, buffer_t* buffer)
+{
+    return plutosvg_document_write_compiled(document, buffer_write, buffer) && !buffer->failed;
+}
+
+/*
+ * Loads a generated document with and without PLUTOSVG_LOAD_FLAGS_PARALLEL and compares the compiled forms, then
+ * checks that both modes reject a malformed copy.
+ */
+static int check_parallel_load(void)
+{
+    size_t size;
+    char* data = generate_document(8 << 20, false, &size);
+    if(data == NULL)
+        return 1;
+    int failures = 0;
+    buffer_t compiled[2] = {{0}, {0}};
+    for(int i = 0; i < 2; ++i) {
+        int flags = i == 0 ? PLUTOSVG_LOAD_FLAGS_NONE : PLUTOSVG_LOAD_FLAGS_PARALLEL;
+        plutosvg_document_t* document = plutosvg_document_load_from_data_with_flags(data, (int)(size), -1, -1, flags, NULL, NULL);
+        if(document == NULL || !write_document(document, compiled + i))
+            failures++;
+        plutosvg_document_destroy(document);
+    }
+
+    bool matches = compiled[0].size == compiled[1].size && memcmp(compiled[0].data, compiled[1].data, compiled[0].size) == 0;
+    fprintf(stdout, "Loaded %zu bytes serially and in parallel: %s\n", size, matches ? "identical" : "MISMATCH");
+    if(!matches)
+        failures++;
+    free(compiled[0].data);
+    free(compiled[1].data);
+    free(data);
+
+    if((data = generate_document(8 << 20, true, &size)) == NULL)
+        return failures + 1;
+    for(int i = 0; i < 2; ++i) {
+        int flags = i == 0 ? PLUTOSVG_LOAD_FLAGS_NONE : PLUTOSVG_LOAD_FLAGS_PARALLEL;
+        plutosvg_document_t* document = plutosvg_document_load_from_data_with_flags(data, (int)(size), -1, -1, flags, NULL, NULL);
+        if(document) {
+            fprintf(stdout, "Loaded a malformed document with flags %d\n", flags);
+            plutosvg_document_destroy(document);
+            failures++;
+        }
+    }
+
+    free(data);
+    return failures;
+}
+
+static void* worker_main(void* data)
+{
+    worker_t* worker = data;
+    plutovg_rect_t expected;
+    plutosvg_document_extents(worker->document, NULL, &expected);
+    for(int i = 0; i < worker->iterations; ++i) {
+        plutovg_rect_t extents;
+        plutosvg_document_extents(worker->document, NULL, &extents);
+        if(memcmp(&extents, &expected, sizeof(extents)) != 0)
+            worker->failures++;
+        bool replay = i % 2 == 1;
+        bool transformed = i % 4 >= 2;
+        plutovg_surface_t* surface = render_document(worker->document, replay, transformed);
+        if(!compare_surfaces(worker->references[transformed], surface, replay && transformed ? REPLAY_TOLERANCE : 0))
+            worker->failures++;
+        plutovg_surface_destroy(surface);
+    }
+
+    return NULL;
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: svgstress input [threads] [iterations]\n");
+        return -1;
+    }
+
+    const char* input = argv[1];
+    int thread_count = argc > 2 ? atoi(argv[2]) : 8;
+    int iterations = argc > 3 ? atoi(argv[3]) : 50;
+    if(thread_count < 1 || thread_count > MAX_THREADS || iterations < 1) {
+        fprintf(stderr, "Invalid thread or iteration count\n");
+        return -1;
+    }
+
+    int status = -1;
+    worker_t workers[MAX_THREADS];
+    plutovg_surface_t* references[2] = {NULL, NULL};
+    plutosvg_document_t* documents[DOCUMENT_COUNT] = {NULL, NULL, NULL, NULL};
+    documents[0] = plutosvg_document_load_from_file(input, -1, -1);
+
+    /*
+     * Two more copies share one arena, so that workers rendering different documents allocate from it at once.
+     */
+    plutosvg_arena_t* arena = plutosvg_arena_create(0);
+    if(arena) {
+        documents[1] = plutosvg_document_load_from_file_with_arena(input, -1, -1, PLUTOSVG_LOAD_FLAGS_NONE, arena);
+        documents[2] = plutosvg_document_load_from_file_with_arena(input, -1, -1, PLUTOSVG_LOAD_FLAGS_NONE, arena);
+    }
+
+    documents[3] = plutosvg_document_load_from_file_with_flags(input, -1, -1, PLUTOSVG_LOAD_FLAGS_PARALLEL);
+    for(int i = 0; i < DOCUMENT_COUNT; ++i) {
+        if(documents[i] == NULL) {
+            fprintf(stderr, "Unable to load '%s'\n", input);
+            goto cleanup;
+        }
+    }
+
+    /*
+     * Render the references from a separate copy so that the workers start on documents whose caches are cold.
+     */
+    plutosvg_document_t* copy = plutosvg_document_load_from_file(input, -1, -1);
+    if(copy) {
+        references[0] = render_document(copy, false, false);
+        references[1] = render_document(copy, false, true);
+    }
+
+    plutosvg_document_destroy(copy);
+    if(references[0] == NULL || references[1] == NULL) {
+        fprintf(stderr, "Unable to render '%s'\n", input);
+        goto cleanup;
+    }
+
+    int started = 0;
+    for(; started < thread_count; ++started) {
+        worker_t* worker = workers + started;
+        worker->document = documents[started % DOCUMENT_COUNT];
+        worker->references[0] = references[0];
+        worker->references[1] = references[1];
+        worker->iterations = iterations;
+        worker->failures = 0;
+        if(pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+            break;
+        }
+    }
+
+    int failures = 0;
+    for(int i = 0; i < started; ++i) {
+        pthread_join(workers[i].thread, NULL);
+        failures += workers[i].failures;
+    }
+
+    fprintf(stdout, "Rendered '%s' %d times on %d threads: %d mismatches\n", input, started * iterations, started, failures);
+    failures += check_bands(documents[0], thread_count);
+    failures += check_parallel_load();
+    if(started == thread_count && failures == 0)
+        status = 0;
+
+cleanup:
+    plutovg_surface_destroy(references[0]);
+    plutovg_surface_destroy(references[1]);
+    for(int i = 0; i < DOCUMENT_COUNT; ++i)
+        plutosvg_document_destroy(documents[i]);
+    plutosvg_arena_destroy(arena);
+    return status;
+}
@@ -79,6 +79,7 @@ typedef struct {
 
 typedef struct {
     plutosvg_document_t* document;
+    const plutosvg_element_t* element;
     plutovg_matrix_t matrix;
     plutovg_rect_t extents;
     plutosvg_ft_document_entry_t entries[PLUTOSVG_FT_MAX_DOCS];
@@ -142,20 +143,9 @@ static FT_Error plutosvg_ft_render(FT_GlyphSlot ft_slot, FT_Pointer* ft_state)
     plutovg_surface_t* surface = plutovg_surface_create_for_data(ft_slot->bitmap.buffer, ft_slot->bitmap.width, ft_slot->bitmap.rows, ft_slot->bitmap.pitch);
     plutovg_canvas_t* canvas = plutovg_canvas_create(surface);
 
-    FT_SVG_Document ft_document = (FT_SVG_Document)ft_slot->other;
-    FT_UShort start_glyph_id = ft_document->start_glyph_id;
-    FT_UShort end_glyph_id = ft_document->end_glyph_id;
-
-    char buffer[64];
-    char* id = NULL;
-    if(start_glyph_id < end_glyph_id) {
-        snprintf(buffer, sizeof(buffer), "glyph%u", ft_slot->glyph_index);
-        id = buffer;
-    }
-
     plutovg_canvas_translate(canvas, -state->extents.x, -state->extents.y);
     plutovg_canvas_transform(canvas, &state->matrix);
-    plutosvg_document_render(state->document, id, canvas, NULL, plutosvg_ft_palette_func, ft_slot->face);
+    plutosvg_document_render_element(state->document, state->element, canvas, NULL, plutosvg_ft_palette_func, ft_slot->face);
 
     ft_slot->bitmap.pixel_mode = FT_PIXEL_MODE_BGRA;
     ft_slot->bitmap.num_grays = 256;
@@ -164,6 +154,7 @@ static FT_Error plutosvg_ft_render(FT_GlyphSlot ft_slot, FT_Pointer* ft_state)
     plutovg_canvas_destroy(canvas);
     plutovg_surface_destroy(surface);
     state->document = NULL;
+    state->element = NULL;
     return FT_Err_Ok;
 }
 
@@ -194,6 +185,21 @@ static plutosvg_document_t* plutosvg_ft_document_load(plutosvg_ft_state_t* state
     return document;
 }
 
+static int plutosvg_ft_glyph_id(char* buffer, FT_UInt glyph_index)
+{
+    char digits[10];
+    int count = 0;
+    do {
+        digits[count++] = '0' + glyph_index % 10;
+        glyph_index /= 10;
+    } while(glyph_index > 0);
+
+    memcpy(buffer, "glyph", 5);
+    for(int i = 0; i < count; ++i)
+        buffer[5 + i] = digits[count - i - 1];
+    return 5 + count;
+}
+
 static FT_Error plutosvg_ft_preset_slot(FT_GlyphSlot ft_slot, FT_Bool ft_cache, FT_Pointer* ft_state)
 {
     plutosvg_ft_state_t* state = (plutosvg_ft_state_t*)(*ft_state);
@@ -228,17 +234,18 @@ static FT_Error plutosvg_ft_preset_slot(FT_GlyphSlot ft_slot, FT_Bool ft_cache,
     plutovg_matrix_init_scale(&matrix, x_svg_to_out, y_svg_to_out);
     plutovg_matrix_multiply(&matrix, &transform, &matrix);
 
-    char buffer[64];
-    char* id = NULL;
+    const plutosvg_element_t* element = NULL;
     if(start_glyph_id < end_glyph_id) {
-        snprintf(buffer, sizeof(buffer), "glyph%u", ft_slot->glyph_index);
-        id = buffer;
+        char buffer[16];
+        int length = plutosvg_ft_glyph_id(buffer, ft_slot->glyph_index);
+        element = plutosvg_document_find(document, buffer, length);
+        if(element == NULL) {
+            return FT_Err_Invalid_SVG_Document;
+        }
     }
 
     plutovg_rect_t extents;
-    if(!plutosvg_document_extents(document, id, &extents)) {
-        return FT_Err_Invalid_SVG_Document;
-    }
+    plutosvg_document_element_extents(document, element, &extents);
 
     plutovg_matrix_map_rect(&matrix, &extents, &extents);
     ft_slot->bitmap_left = (FT_Int)extents.x;
@@ -269,6 +276,7 @@ static FT_Error plutosvg_ft_preset_slot(FT_GlyphSlot ft_slot, FT_Bool ft_cache,
         ft_slot->metrics.vertAdvance = (FT_Pos)(metrics_height * 1.2f * 64);
     if(ft_cache) {
         state->document = document;
+        state->element = element;
         state->extents = extents;
         state->matrix = matrix;
     }
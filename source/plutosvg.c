@@ -1,12 +1,88 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include "plutosvg.h"
 
+#include <assert.h>
 #include <stdint.h>
 #include <float.h>
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#define PLUTOSVG_HAS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(PLUTOSVG_HAS_THREADS) && !defined(_WIN32)
+#include <pthread.h>
+#endif
+
+#if defined(PLUTOSVG_HAS_THREADS) && defined(_WIN32)
+typedef CRITICAL_SECTION mutex_t;
+#define mutex_init(mutex) InitializeCriticalSection(mutex)
+#define mutex_destroy(mutex) DeleteCriticalSection(mutex)
+#define mutex_lock(mutex) EnterCriticalSection((mutex_t*)(mutex))
+#define mutex_unlock(mutex) LeaveCriticalSection((mutex_t*)(mutex))
+#elif defined(PLUTOSVG_HAS_THREADS)
+typedef pthread_mutex_t mutex_t;
+#define mutex_init(mutex) pthread_mutex_init(mutex, NULL)
+#define mutex_destroy(mutex) pthread_mutex_destroy(mutex)
+#define mutex_lock(mutex) pthread_mutex_lock((mutex_t*)(mutex))
+#define mutex_unlock(mutex) pthread_mutex_unlock((mutex_t*)(mutex))
+#else
+typedef int mutex_t;
+#define mutex_init(mutex) ((void)(mutex))
+#define mutex_destroy(mutex) ((void)(mutex))
+#define mutex_lock(mutex) ((void)(mutex))
+#define mutex_unlock(mutex) ((void)(mutex))
+#endif
+
+/*
+ * Values that are written under a lock but read without one are published with a release store and read
+ * with an acquire load.
+ */
+#if defined(PLUTOSVG_HAS_THREADS) && (defined(__GNUC__) || defined(__clang__))
+#define atomic_load_ptr(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define atomic_store_ptr(ptr, value) __atomic_store_n(ptr, value, __ATOMIC_RELEASE)
+#define atomic_load_int(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define atomic_store_int(ptr, value) __atomic_store_n(ptr, value, __ATOMIC_RELEASE)
+#elif defined(PLUTOSVG_HAS_THREADS) && defined(_WIN32)
+static inline void* atomic_load_ptr_barrier(void* volatile* ptr)
+{
+    void* value = *ptr;
+    MemoryBarrier();
+    return value;
+}
+
+static inline long atomic_load_int_barrier(volatile long* ptr)
+{
+    long value = *ptr;
+    MemoryBarrier();
+    return value;
+}
+
+#define atomic_load_ptr(ptr) atomic_load_ptr_barrier((void* volatile*)(ptr))
+#define atomic_store_ptr(ptr, value) InterlockedExchangePointer((void* volatile*)(ptr), (void*)(value))
+#define atomic_load_int(ptr) atomic_load_int_barrier((volatile long*)(ptr))
+#define atomic_store_int(ptr, value) InterlockedExchange((volatile long*)(ptr), (value))
+#else
+#define atomic_load_ptr(ptr) (*(ptr))
+#define atomic_store_ptr(ptr, value) (*(ptr) = (value))
+#define atomic_load_int(ptr) (*(ptr))
+#define atomic_store_int(ptr, value) (*(ptr) = (value))
+#endif
+
 int plutosvg_version(void)
 {
     return PLUTOSVG_VERSION;
@@ -17,477 +93,911 @@ const char* plutosvg_version_string(void)
     return PLUTOSVG_VERSION_STRING;
 }
 
+#define ELEMENT_NAMES(X) \
+    X(TAG_CIRCLE, "circle") \
+    X(TAG_CLIP_PATH, "clipPath") /* TODO */ \
+    X(TAG_DEFS, "defs") \
+    X(TAG_ELLIPSE, "ellipse") \
+    X(TAG_G, "g") \
+    X(TAG_IMAGE, "image") \
+    X(TAG_LINE, "line") \
+    X(TAG_LINEAR_GRADIENT, "linearGradient") \
+    X(TAG_PATH, "path") \
+    X(TAG_POLYGON, "polygon") \
+    X(TAG_POLYLINE, "polyline") \
+    X(TAG_RADIAL_GRADIENT, "radialGradient") \
+    X(TAG_RECT, "rect") \
+    X(TAG_STOP, "stop") \
+    X(TAG_SVG, "svg") \
+    X(TAG_SYMBOL, "symbol") \
+    X(TAG_USE, "use")
+
+#define ATTRIBUTE_NAMES(X, ALIAS) \
+    X(ATTR_CLIP_PATH, "clip-path", true) \
+    X(ATTR_CLIP_RULE, "clip-rule", true) \
+    X(ATTR_CLIP_PATH_UNITS, "clipPathUnits", false) \
+    X(ATTR_COLOR, "color", true) \
+    X(ATTR_CX, "cx", false) \
+    X(ATTR_CY, "cy", false) \
+    X(ATTR_D, "d", false) \
+    X(ATTR_DISPLAY, "display", true) \
+    X(ATTR_FILL, "fill", true) \
+    X(ATTR_FILL_OPACITY, "fill-opacity", true) \
+    X(ATTR_FILL_RULE, "fill-rule", true) \
+    X(ATTR_FX, "fx", false) \
+    X(ATTR_FY, "fy", false) \
+    X(ATTR_GRADIENT_TRANSFORM, "gradientTransform", false) \
+    X(ATTR_GRADIENT_UNITS, "gradientUnits", false) \
+    X(ATTR_HEIGHT, "height", false) \
+    X(ATTR_HREF, "href", false) \
+    X(ATTR_ID, "id", false) \
+    X(ATTR_OFFSET, "offset", false) \
+    X(ATTR_OPACITY, "opacity", true) \
+    X(ATTR_POINTS, "points", false) \
+    X(ATTR_PRESERVE_ASPECT_RATIO, "preserveAspectRatio", false) \
+    X(ATTR_R, "r", false) \
+    X(ATTR_RX, "rx", false) \
+    X(ATTR_RY, "ry", false) \
+    X(ATTR_SPREAD_METHOD, "spreadMethod", false) \
+    X(ATTR_STOP_COLOR, "stop-color", true) \
+    X(ATTR_STOP_OPACITY, "stop-opacity", true) \
+    X(ATTR_STROKE, "stroke", true) \
+    X(ATTR_STROKE_DASHARRAY, "stroke-dasharray", true) \
+    X(ATTR_STROKE_DASHOFFSET, "stroke-dashoffset", true) \
+    X(ATTR_STROKE_LINECAP, "stroke-linecap", true) \
+    X(ATTR_STROKE_LINEJOIN, "stroke-linejoin", true) \
+    X(ATTR_STROKE_MITERLIMIT, "stroke-miterlimit", true) \
+    X(ATTR_STROKE_OPACITY, "stroke-opacity", true) \
+    X(ATTR_STROKE_WIDTH, "stroke-width", true) \
+    X(ATTR_STYLE, "style", false) \
+    X(ATTR_TRANSFORM, "transform", false) \
+    X(ATTR_VIEW_BOX, "viewBox", false) \
+    X(ATTR_VISIBILITY, "visibility", true) \
+    X(ATTR_WIDTH, "width", false) \
+    X(ATTR_X, "x", false) \
+    X(ATTR_X1, "x1", false) \
+    X(ATTR_X2, "x2", false) \
+    ALIAS(ATTR_HREF, "xlink:href", false) \
+    X(ATTR_Y, "y", false) \
+    X(ATTR_Y1, "y1", false) \
+    X(ATTR_Y2, "y2", false)
+
+#define ELEMENT_ENUM(id, name) id,
+#define ELEMENT_ENTRY(id, name) {name, sizeof(name) - 1, id, false},
+#define ATTRIBUTE_ENUM(id, name, css) id,
+#define ATTRIBUTE_ALIAS(id, name, css)
+#define ATTRIBUTE_ENTRY(id, name, css) {name, sizeof(name) - 1, id, css},
+
 enum {
     TAG_UNKNOWN = 0,
-    TAG_CIRCLE,
-    TAG_CLIP_PATH, // TODO
-    TAG_DEFS,
-    TAG_ELLIPSE,
-    TAG_G,
-    TAG_IMAGE,
-    TAG_LINE,
-    TAG_LINEAR_GRADIENT,
-    TAG_PATH,
-    TAG_POLYGON,
-    TAG_POLYLINE,
-    TAG_RADIAL_GRADIENT,
-    TAG_RECT,
-    TAG_STOP,
-    TAG_SVG,
-    TAG_SYMBOL,
-    TAG_USE
+    ELEMENT_NAMES(ELEMENT_ENUM)
+    TAG_COUNT
 };
 
 enum {
     ATTR_UNKNOWN = 0,
-    ATTR_CLIP_PATH,
-    ATTR_CLIP_PATH_UNITS,
-    ATTR_CLIP_RULE,
-    ATTR_COLOR,
-    ATTR_CX,
-    ATTR_CY,
-    ATTR_D,
-    ATTR_DISPLAY,
-    ATTR_FILL,
-    ATTR_FILL_OPACITY,
-    ATTR_FILL_RULE,
-    ATTR_FX,
-    ATTR_FY,
-    ATTR_GRADIENT_TRANSFORM,
-    ATTR_GRADIENT_UNITS,
-    ATTR_HEIGHT,
-    ATTR_HREF,
-    ATTR_ID,
-    ATTR_OFFSET,
-    ATTR_OPACITY,
-    ATTR_POINTS,
-    ATTR_PRESERVE_ASPECT_RATIO,
-    ATTR_R,
-    ATTR_RX,
-    ATTR_RY,
-    ATTR_SPREAD_METHOD,
-    ATTR_STOP_COLOR,
-    ATTR_STOP_OPACITY,
-    ATTR_STROKE,
-    ATTR_STROKE_DASHARRAY,
-    ATTR_STROKE_DASHOFFSET,
-    ATTR_STROKE_LINECAP,
-    ATTR_STROKE_LINEJOIN,
-    ATTR_STROKE_MITERLIMIT,
-    ATTR_STROKE_OPACITY,
-    ATTR_STROKE_WIDTH,
-    ATTR_STYLE,
-    ATTR_TRANSFORM,
-    ATTR_VIEW_BOX,
-    ATTR_VISIBILITY,
-    ATTR_WIDTH,
-    ATTR_X,
-    ATTR_X1,
-    ATTR_X2,
-    ATTR_Y,
-    ATTR_Y1,
-    ATTR_Y2
+    ATTRIBUTE_NAMES(ATTRIBUTE_ENUM, ATTRIBUTE_ALIAS)
+    ATTR_COUNT
 };
 
-#define MAX_NAME 19
-
 typedef struct {
     const char* name;
-    int id;
+    uint8_t length;
+    uint8_t id;
+    bool css;
 } name_entry_t;
 
-static int name_entry_compare(const void* a, const void* b)
+/*
+ * The slot tables below form a collision-free hash over the names listed above:
+ * each slot holds the one-based position of a name in its list, or zero if empty.
+ * Rebuild them with name_hash whenever ELEMENT_NAMES or ATTRIBUTE_NAMES change; debug builds check on
+ * every load that each listed name still maps back to its id (see check_name_tables).
+ */
+
+static inline unsigned name_hash(const char* data, size_t length)
 {
-    const char* name = a;
-    const name_entry_t* entry = b;
-    return strcmp(name, entry->name);
+    const uint8_t* name = (const uint8_t*)(data);
+    return length * 54 + name[0] * 45 + name[length / 2] * 62 + name[length - 1] * 25;
 }
 
-static int lookupid(const char* data, size_t length, const name_entry_t* table, size_t count)
+static const name_entry_t* lookup_name(const char* data, size_t length, const name_entry_t* entries, const uint8_t* slots, unsigned mask)
 {
-    if(length > MAX_NAME)
-        return 0;
-    char name[MAX_NAME + 1];
-    for(int i = 0; i < length; i++)
-        name[i] = data[i];
-    name[length] = '\0';
-
-    name_entry_t* entry = bsearch(name, table, count / sizeof(name_entry_t), sizeof(name_entry_t), name_entry_compare);
-    if(entry == NULL)
-        return 0;
-    return entry->id;
+    if(length == 0)
+        return NULL;
+    int slot = slots[name_hash(data, length) & mask];
+    if(slot == 0)
+        return NULL;
+    const name_entry_t* entry = &entries[slot - 1];
+    if(entry->length != length || memcmp(entry->name, data, length))
+        return NULL;
+    return entry;
 }
 
+static const name_entry_t element_entries[] = {
+    ELEMENT_NAMES(ELEMENT_ENTRY)
+};
+
+static const uint8_t element_slots[32] = {
+     8, 14,  1, 16,  0, 11,  4,  0,  9,  0, 17,  0,  0,  0, 12,  0,
+    13,  0,  5,  0,  0,  7, 10,  0,  0,  0,  0,  3, 15,  0,  6,  2
+};
+
+static const name_entry_t attribute_entries[] = {
+    ATTRIBUTE_NAMES(ATTRIBUTE_ENTRY, ATTRIBUTE_ENTRY)
+};
+
+static const uint8_t attribute_slots[128] = {
+     0,  0, 44,  0,  0,  0,  0,  0,  0,  0,  0,  0, 17,  0,  0, 34,
+     2,  0,  0,  0,  0, 25, 42, 11,  0, 40, 46,  5,  0,  0,  0, 31,
+     0,  0, 12,  0,  0,  0,  0,  0,  0, 26,  0, 43,  0,  0, 14, 48,
+    28,  0,  0,  0,  0,  0, 45,  0, 15,  0, 29,  0,  0,  0, 24,  4,
+     0,  0, 39, 32,  0,  0,  7, 33, 20, 38,  0,  0,  0, 36,  0,  0,
+     0,  0, 16, 21,  0,  0,  0,  0, 47, 41,  0,  1,  0, 18, 35,  0,
+     0,  0,  0, 22,  0,  0, 30, 10,  0,  0,  0,  0,  0,  0,  0, 27,
+    37,  0,  6,  0,  0, 19,  0,  0,  3, 13,  9,  0,  0,  0, 23,  8
+};
+
 static int elementid(const char* data, size_t length)
 {
-    static const name_entry_t table[] = {
-        {"circle", TAG_CIRCLE},
-        {"clipPath", TAG_CLIP_PATH},
-        {"defs", TAG_DEFS},
-        {"ellipse", TAG_ELLIPSE},
-        {"g", TAG_G},
-        {"image", TAG_IMAGE},
-        {"line", TAG_LINE},
-        {"linearGradient", TAG_LINEAR_GRADIENT},
-        {"path", TAG_PATH},
-        {"polygon", TAG_POLYGON},
-        {"polyline", TAG_POLYLINE},
-        {"radialGradient", TAG_RADIAL_GRADIENT},
-        {"rect", TAG_RECT},
-        {"stop", TAG_STOP},
-        {"svg", TAG_SVG},
-        {"symbol", TAG_SYMBOL},
-        {"use", TAG_USE}
-    };
-
-    return lookupid(data, length, table, sizeof(table));
+    const name_entry_t* entry = lookup_name(data, length, element_entries, element_slots, 31);
+    if(entry == NULL)
+        return TAG_UNKNOWN;
+    return entry->id;
 }
 
 static int attributeid(const char* data, size_t length)
 {
-    static const name_entry_t table[] = {
-        {"clip-path", ATTR_CLIP_PATH},
-        {"clip-rule", ATTR_CLIP_RULE},
-        {"clipPathUnits", ATTR_CLIP_PATH_UNITS},
-        {"color", ATTR_COLOR},
-        {"cx", ATTR_CX},
-        {"cy", ATTR_CY},
-        {"d", ATTR_D},
-        {"display", ATTR_DISPLAY},
-        {"fill", ATTR_FILL},
-        {"fill-opacity", ATTR_FILL_OPACITY},
-        {"fill-rule", ATTR_FILL_RULE},
-        {"fx", ATTR_FX},
-        {"fy", ATTR_FY},
-        {"gradientTransform", ATTR_GRADIENT_TRANSFORM},
-        {"gradientUnits", ATTR_GRADIENT_UNITS},
-        {"height", ATTR_HEIGHT},
-        {"href", ATTR_HREF},
-        {"id", ATTR_ID},
-        {"offset", ATTR_OFFSET},
-        {"opacity", ATTR_OPACITY},
-        {"points", ATTR_POINTS},
-        {"preserveAspectRatio", ATTR_PRESERVE_ASPECT_RATIO},
-        {"r", ATTR_R},
-        {"rx", ATTR_RX},
-        {"ry", ATTR_RY},
-        {"spreadMethod", ATTR_SPREAD_METHOD},
-        {"stop-color", ATTR_STOP_COLOR},
-        {"stop-opacity", ATTR_STOP_OPACITY},
-        {"stroke", ATTR_STROKE},
-        {"stroke-dasharray", ATTR_STROKE_DASHARRAY},
-        {"stroke-dashoffset", ATTR_STROKE_DASHOFFSET},
-        {"stroke-linecap", ATTR_STROKE_LINECAP},
-        {"stroke-linejoin", ATTR_STROKE_LINEJOIN},
-        {"stroke-miterlimit", ATTR_STROKE_MITERLIMIT},
-        {"stroke-opacity", ATTR_STROKE_OPACITY},
-        {"stroke-width", ATTR_STROKE_WIDTH},
-        {"style", ATTR_STYLE},
-        {"transform", ATTR_TRANSFORM},
-        {"viewBox", ATTR_VIEW_BOX},
-        {"visibility", ATTR_VISIBILITY},
-        {"width", ATTR_WIDTH},
-        {"x", ATTR_X},
-        {"x1", ATTR_X1},
-        {"x2", ATTR_X2},
-        {"xlink:href", ATTR_HREF},
-        {"y", ATTR_Y},
-        {"y1", ATTR_Y1},
-        {"y2", ATTR_Y2}
-    };
-
-    return lookupid(data, length, table, sizeof(table));
+    const name_entry_t* entry = lookup_name(data, length, attribute_entries, attribute_slots, 127);
+    if(entry == NULL)
+        return ATTR_UNKNOWN;
+    return entry->id;
 }
 
 static int cssattributeid(const char* data, size_t length)
 {
-    static const name_entry_t table[] = {
-        {"clip-path", ATTR_CLIP_PATH},
-        {"clip-rule", ATTR_CLIP_RULE},
-        {"color", ATTR_COLOR},
-        {"display", ATTR_DISPLAY},
-        {"fill", ATTR_FILL},
-        {"fill-opacity", ATTR_FILL_OPACITY},
-        {"fill-rule", ATTR_FILL_RULE},
-        {"opacity", ATTR_OPACITY},
-        {"stop-color", ATTR_STOP_COLOR},
-        {"stop-opacity", ATTR_STOP_OPACITY},
-        {"stroke", ATTR_STROKE},
-        {"stroke-dasharray", ATTR_STROKE_DASHARRAY},
-        {"stroke-dashoffset", ATTR_STROKE_DASHOFFSET},
-        {"stroke-linecap", ATTR_STROKE_LINECAP},
-        {"stroke-linejoin", ATTR_STROKE_LINEJOIN},
-        {"stroke-miterlimit", ATTR_STROKE_MITERLIMIT},
-        {"stroke-opacity", ATTR_STROKE_OPACITY},
-        {"stroke-width", ATTR_STROKE_WIDTH},
-        {"visibility", ATTR_VISIBILITY}
-    };
-
-    return lookupid(data, length, table, sizeof(table));
+    const name_entry_t* entry = lookup_name(data, length, attribute_entries, attribute_slots, 127);
+    if(entry == NULL || !entry->css)
+        return ATTR_UNKNOWN;
+    return entry->id;
+}
+
+#if !defined(NDEBUG)
+
+static void check_name_tables(void)
+{
+    for(size_t i = 0; i < sizeof(element_entries) / sizeof(name_entry_t); ++i) {
+        const name_entry_t* entry = element_entries + i;
+        assert(elementid(entry->name, entry->length) == entry->id);
+    }
+
+    for(size_t i = 0; i < sizeof(attribute_entries) / sizeof(name_entry_t); ++i) {
+        const name_entry_t* entry = attribute_entries + i;
+        assert(attributeid(entry->name, entry->length) == entry->id);
+        assert(cssattributeid(entry->name, entry->length) == (entry->css ? entry->id : ATTR_UNKNOWN));
+    }
 }
 
+#endif
+
 typedef struct {
     const char* data;
     size_t length;
 } string_t;
 
-typedef struct attribute {
+typedef struct {
     int id;
     string_t value;
-    struct attribute* next;
 } attribute_t;
 
-typedef struct element {
-    int id;
-    struct element* parent;
-    struct element* last_child;
-    struct element* first_child;
-    struct element* next_sibling;
-    struct attribute* attributes;
-} element_t;
+/*
+ * Storage for one compiled attribute value; large enough to hold any of the parsed value types.
+ */
+typedef struct {
+    uint64_t data[4];
+} property_t;
 
-typedef struct heap_chunk {
-    struct heap_chunk* next;
-} heap_chunk_t;
+/*
+ * Parsed geometry of a path, polyline or polygon element; built once and never modified.
+ */
+typedef struct {
+    plutovg_path_t* path;
+    plutovg_rect_t extents;
+} shape_t;
 
+/*
+ * Source ranges of a subtree whose attributes and children have not been parsed yet.
+ */
 typedef struct {
-    heap_chunk_t* chunk;
+    const char* attributes_begin;
+    const char* attributes_end;
+    const char* content_begin;
+    const char* content_end;
+} subtree_t;
+
+/*
+ * Elements live in one array per document, in depth-first order except for lazily materialized subtrees,
+ * which are appended when first used. Links are offsets from the element itself, with 0 meaning none,
+ * so they survive the array being moved while it is built. Attributes are packed in declaration order.
+ */
+typedef struct plutosvg_element {
+    int id;
+    int32_t parent;
+    int32_t last_child;
+    int32_t first_child;
+    int32_t next_sibling;
+    uint32_t attribute_count;
+    const attribute_t* attributes;
+    uint64_t attribute_mask;
+    uint64_t inherit_mask;
+    uint64_t property_mask;
+    const property_t* properties;
+    const struct style* style;
+    const shape_t* shape;
+    const subtree_t* subtree;
+} element_t;
+
+typedef struct arena_block {
+    struct arena_block* next;
+    size_t capacity;
+} arena_block_t;
+
+/*
+ * Arenas created by the caller may back several documents that are rendered on different threads, and
+ * rendering allocates shapes, cached bounds and lazily parsed subtrees; such arenas are shared and
+ * take their lock on every allocation. Arenas private to a document or display list are only used under
+ * that object's own locks and skip it.
+ */
+struct plutosvg_arena {
+    arena_block_t* blocks;
+    arena_block_t* free_blocks;
+    arena_block_t* large_blocks;
+    size_t block_size;
     size_t size;
-} heap_t;
+    bool shared;
+    mutex_t lock;
+};
+
+#define ALIGN_SIZE(size) (((size) + 7ul) & ~7ul)
+#define ARENA_HEADER_SIZE ALIGN_SIZE(sizeof(arena_block_t))
+#define ARENA_MIN_BLOCK_SIZE 4096
+#define ARENA_MAX_BLOCK_SIZE (1 << 22)
 
-static heap_t* heap_create(void)
+static size_t arena_block_size(size_t size)
 {
-    heap_t* heap = malloc(sizeof(heap_t));
-    heap->chunk = NULL;
-    heap->size = 0;
-    return heap;
+    if(size < ARENA_MIN_BLOCK_SIZE)
+        return ARENA_MIN_BLOCK_SIZE;
+    if(size > ARENA_MAX_BLOCK_SIZE)
+        return ARENA_MAX_BLOCK_SIZE;
+    return ALIGN_SIZE(size);
 }
 
-#define CHUNK_SIZE 4096
-#define ALIGN_SIZE(size) (((size) + 7ul) & ~7ul)
+static plutosvg_arena_t* arena_create(size_t size, bool shared)
+{
+    plutosvg_arena_t* arena = malloc(sizeof(plutosvg_arena_t));
+    if(arena == NULL)
+        return NULL;
+    arena->blocks = NULL;
+    arena->free_blocks = NULL;
+    arena->large_blocks = NULL;
+    arena->block_size = arena_block_size(size);
+    arena->size = 0;
+    arena->shared = shared;
+    mutex_init(&arena->lock);
+    return arena;
+}
+
+plutosvg_arena_t* plutosvg_arena_create(size_t size)
+{
+    return arena_create(size, true);
+}
 
-static void* heap_alloc(heap_t* heap, size_t size)
+static void* arena_alloc_unlocked(plutosvg_arena_t* arena, size_t size)
 {
     size = ALIGN_SIZE(size);
-    if(heap->chunk == NULL || heap->size + size > CHUNK_SIZE) {
-        heap_chunk_t* chunk = malloc(CHUNK_SIZE + sizeof(heap_chunk_t));
-        chunk->next = heap->chunk;
-        heap->chunk = chunk;
-        heap->size = 0;
+    if(arena->blocks && size <= arena->blocks->capacity - arena->size) {
+        void* data = (char*)(arena->blocks) + ARENA_HEADER_SIZE + arena->size;
+        arena->size += size;
+        return data;
+    }
+
+    if(size > arena->block_size / 2) {
+        arena_block_t* block = malloc(ARENA_HEADER_SIZE + size);
+        block->next = arena->large_blocks;
+        block->capacity = size;
+        arena->large_blocks = block;
+        return (char*)(block) + ARENA_HEADER_SIZE;
+    }
+
+    arena_block_t** it = &arena->free_blocks;
+    while(*it && (*it)->capacity < size)
+        it = &(*it)->next;
+    arena_block_t* block = *it;
+    if(block) {
+        *it = block->next;
+    } else {
+        block = malloc(ARENA_HEADER_SIZE + arena->block_size);
+        block->capacity = arena->block_size;
+        if(arena->block_size < ARENA_MAX_BLOCK_SIZE) {
+            arena->block_size *= 2;
+        }
     }
 
-    void* data = (char*)(heap->chunk) + sizeof(heap_chunk_t) + heap->size;
-    heap->size += size;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->size = size;
+    return (char*)(block) + ARENA_HEADER_SIZE;
+}
+
+static void* arena_alloc(plutosvg_arena_t* arena, size_t size)
+{
+    if(!arena->shared)
+        return arena_alloc_unlocked(arena, size);
+    mutex_lock(&arena->lock);
+    void* data = arena_alloc_unlocked(arena, size);
+    mutex_unlock(&arena->lock);
     return data;
 }
 
-static void heap_destroy(heap_t* heap)
+static void arena_free_blocks(arena_block_t* block)
+{
+    while(block) {
+        arena_block_t* next = block->next;
+        free(block);
+        block = next;
+    }
+}
+
+void plutosvg_arena_reset(plutosvg_arena_t* arena)
 {
-    while(heap->chunk) {
-        heap_chunk_t* chunk = heap->chunk;
-        heap->chunk = chunk->next;
-        free(chunk);
+    while(arena->blocks) {
+        arena_block_t* block = arena->blocks;
+        arena->blocks = block->next;
+        block->next = arena->free_blocks;
+        arena->free_blocks = block;
     }
 
-    free(heap);
+    arena_free_blocks(arena->large_blocks);
+    arena->large_blocks = NULL;
+    arena->size = 0;
+}
+
+void plutosvg_arena_destroy(plutosvg_arena_t* arena)
+{
+    if(arena == NULL)
+        return;
+    arena_free_blocks(arena->blocks);
+    arena_free_blocks(arena->free_blocks);
+    arena_free_blocks(arena->large_blocks);
+    mutex_destroy(&arena->lock);
+    free(arena);
 }
 
-typedef struct hashmap_entry {
-    size_t hash;
-    string_t name;
-    void* value;
-    struct hashmap_entry* next;
-} hashmap_entry_t;
+typedef struct {
+    const char* data;
+    uint32_t length;
+    uint32_t hash;
+    element_t* element;
+} id_slot_t;
 
 typedef struct {
-    hashmap_entry_t** buckets;
+    id_slot_t* slots;
     size_t size;
     size_t capacity;
-} hashmap_t;
+} id_index_t;
 
-static hashmap_t* hashmap_create(void)
+static uint32_t id_hash(const char* data, size_t length)
 {
-    hashmap_t* map = malloc(sizeof(hashmap_t));
-    map->buckets = calloc(16, sizeof(hashmap_entry_t*));
-    map->size = 0;
-    map->capacity = 16;
-    return map;
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ length;
+    while(length >= 8) {
+        uint64_t v;
+        memcpy(&v, data, 8);
+        h = (h ^ v) * 0xBF58476D1CE4E5B9ull;
+        h ^= h >> 31;
+        data += 8;
+        length -= 8;
+    }
+
+    uint64_t v = 0;
+    memcpy(&v, data, length);
+    h = (h ^ v) * 0x94D049BB133111EBull;
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 32;
+    return (uint32_t)(h);
 }
 
-static size_t hashmap_hash(const char* data, size_t length)
+static void id_index_init(id_index_t* index)
 {
-    size_t h = length;
-    for(size_t i = 0; i < length; i++) {
-        h = h * 31 + *data;
-        ++data;
-    }
+    index->slots = NULL;
+    index->size = 0;
+    index->capacity = 0;
+}
 
-    return h;
+static id_slot_t* id_index_probe(const id_index_t* index, const char* data, size_t length, uint32_t hash)
+{
+    size_t mask = index->capacity - 1;
+    size_t position = hash & mask;
+    while(true) {
+        id_slot_t* slot = index->slots + position;
+        if(slot->element == NULL)
+            return slot;
+        if(slot->hash == hash && slot->length == length && memcmp(slot->data, data, length) == 0)
+            return slot;
+        position = (position + 1) & mask;
+    }
 }
 
-static bool hashmap_eq(const hashmap_entry_t* entry, const char* data, size_t length)
+static bool id_index_reserve(id_index_t* index, size_t count)
 {
-    const string_t* name = &entry->name;
-    if(name->length != length)
+    size_t capacity = 16;
+    while(capacity / 2 < count)
+        capacity *= 2;
+    if(capacity <= index->capacity)
+        return true;
+    id_slot_t* slots = calloc(capacity, sizeof(id_slot_t));
+    if(slots == NULL)
         return false;
-    for(size_t i = 0; i < length; i++) {
-        if(data[i] != name->data[i]) {
-            return false;
+    id_index_t newindex = {slots, index->size, capacity};
+    for(size_t i = 0; i < index->capacity; ++i) {
+        const id_slot_t* slot = index->slots + i;
+        if(slot->element) {
+            *id_index_probe(&newindex, slot->data, slot->length, slot->hash) = *slot;
         }
     }
 
+    free(index->slots);
+    *index = newindex;
     return true;
 }
 
-static void hashmap_expand(hashmap_t* map)
+static void id_index_put(id_index_t* index, const char* data, size_t length, element_t* element)
 {
-    if(map->size > (map->capacity * 3 / 4)) {
-        size_t newcapacity = map->capacity << 1;
-        hashmap_entry_t** newbuckets = calloc(newcapacity, sizeof(hashmap_entry_t*));
-        for(size_t i = 0; i < map->capacity; i++) {
-            hashmap_entry_t* entry = map->buckets[i];
-            while(entry) {
-                hashmap_entry_t* next = entry->next;
-                size_t index = entry->hash & (newcapacity - 1);
-                entry->next = newbuckets[index];
-                newbuckets[index] = entry;
-                entry = next;
-            }
-        }
-
-        free(map->buckets);
-        map->buckets = newbuckets;
-        map->capacity = newcapacity;
+    if(length > UINT32_MAX)
+        return;
+    if((index->size + 1) * 4 > index->capacity * 3 && !id_index_reserve(index, index->size + 1))
+        return;
+    uint32_t hash = id_hash(data, length);
+    id_slot_t* slot = id_index_probe(index, data, length, hash);
+    if(slot->element == NULL) {
+        slot->data = data;
+        slot->length = length;
+        slot->hash = hash;
+        index->size += 1;
     }
+
+    slot->element = element;
 }
 
-static void hashmap_put(hashmap_t* map, heap_t* heap, const char* data, size_t length, void* value)
+static element_t* id_index_get(const id_index_t* index, const char* data, size_t length)
 {
-    size_t hash = hashmap_hash(data, length);
-    size_t index = hash & (map->capacity - 1);
-
-    hashmap_entry_t** p = &map->buckets[index];
-    while(true) {
-        hashmap_entry_t* current = *p;
-        if(current == NULL) {
-            hashmap_entry_t* entry = heap_alloc(heap, sizeof(hashmap_entry_t));
-            entry->name.data = data;
-            entry->name.length = length;
-            entry->hash = hash;
-            entry->value = value;
-            entry->next = NULL;
-            *p = entry;
-            map->size += 1;
-            hashmap_expand(map);
-            break;
-        }
+    if(index->size == 0)
+        return NULL;
+    return id_index_probe(index, data, length, id_hash(data, length))->element;
+}
 
-        if(current->hash == hash && hashmap_eq(current, data, length)) {
-            current->value = value;
-            break;
-        }
 
-        p = &current->next;
-    }
+static inline element_t* element_link(const element_t* element, int32_t offset)
+{
+    return offset ? (element_t*)(element + offset) : NULL;
 }
 
-static void* hashmap_get(const hashmap_t* map, const char* data, size_t length)
+static inline element_t* element_parent(const element_t* element)
 {
-    size_t hash = hashmap_hash(data, length);
-    size_t index = hash & (map->capacity - 1);
+    return element_link(element, element->parent);
+}
 
-    hashmap_entry_t* entry = map->buckets[index];
-    while(entry) {
-        if(entry->hash == hash && hashmap_eq(entry, data, length))
-            return entry->value;
-        entry = entry->next;
-    }
+static inline element_t* element_first_child(const element_t* element)
+{
+    return element_link(element, element->first_child);
+}
 
-    return NULL;
+static inline element_t* element_next_sibling(const element_t* element)
+{
+    return element_link(element, element->next_sibling);
 }
 
-static void hashmap_destroy(hashmap_t* map)
+#define ATTRIBUTE_BIT(id) (UINT64_C(1) << (id))
+
+/* The attribute and inherit masks hold one bit per attribute id. */
+typedef char attribute_mask_check_t[(ATTR_COUNT <= 64) ? 1 : -1];
+
+static inline int popcount(uint64_t value)
 {
-    if(map == NULL)
-        return;
-    free(map->buckets);
-    free(map);
+#if defined(__GNUC__)
+    return __builtin_popcountll(value);
+#else
+    int count = 0;
+    while(value) {
+        value &= value - 1;
+        ++count;
+    }
+
+    return count;
+#endif
 }
 
-static inline const string_t* find_attribute(const element_t* element, int id, bool inherit)
+static inline const element_t* find_attribute_element(const element_t* element, int id, bool inherit)
 {
-    do {
-        const attribute_t* attribute = element->attributes;
-        while(attribute != NULL) {
-            if(attribute->id == id) {
-                const string_t* value = &attribute->value;
-                if(inherit && value->length == 7 && strncmp(value->data, "inherit", 7) == 0)
-                    break;
-                return value;
+    const uint64_t bit = ATTRIBUTE_BIT(id);
+    while(element) {
+        if(element->attribute_mask & bit) {
+            if(!inherit || !(element->inherit_mask & bit)) {
+                return element;
             }
+        }
 
-            attribute = attribute->next;
+        if(!inherit)
+            break;
+        element = element_parent(element);
+    }
+
+    return NULL;
+}
+
+static inline const string_t* find_attribute_value(const element_t* element, int id)
+{
+    for(uint32_t i = element->attribute_count; i > 0; --i) {
+        const attribute_t* attribute = element->attributes + i - 1;
+        if(attribute->id == id) {
+            return &attribute->value;
         }
+    }
 
-        element = element->parent;
-    } while(inherit && element);
     return NULL;
 }
 
-static inline bool has_attribute(const element_t* element, int id)
+static inline const string_t* find_attribute(const element_t* element, int id, bool inherit)
 {
-    const attribute_t* attribute = element->attributes;
-    while(attribute != NULL) {
-        if(attribute->id == id)
-            return true;
-        attribute = attribute->next;
+    element = find_attribute_element(element, id, inherit);
+    if(element == NULL)
+        return NULL;
+    return find_attribute_value(element, id);
+}
+
+/*
+ * Looks up an attribute like find_attribute, but copies its compiled value into `property` when the
+ * element providing it was compiled. Returns false with `*value` set to the attribute string, or NULL,
+ * when no compiled value is available.
+ */
+static bool find_property(const element_t* element, int id, bool inherit, void* property, size_t size, const string_t** value)
+{
+    element = find_attribute_element(element, id, inherit);
+    if(element == NULL) {
+        *value = NULL;
+        return false;
     }
 
+    const uint64_t bit = ATTRIBUTE_BIT(id);
+    if(element->property_mask & bit) {
+        memcpy(property, element->properties + popcount(element->property_mask & (bit - 1)), size);
+        return true;
+    }
+
+    *value = find_attribute_value(element, id);
     return false;
 }
 
+static inline bool has_attribute(const element_t* element, int id)
+{
+    return element->attribute_mask & ATTRIBUTE_BIT(id);
+}
+
 #define IS_NUM(c) ((c) >= '0' && (c) <= '9')
 #define IS_ALPHA(c) (((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z'))
 #define IS_WS(c) ((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r')
 
+#define SMALLEST_POWER_OF_TEN -64
+#define LARGEST_POWER_OF_TEN 38
+
+/*
+ * 128-bit approximations of 5^q for q in [SMALLEST_POWER_OF_TEN, LARGEST_POWER_OF_TEN], normalized so that
+ * the most significant bit is set. Negative powers are rounded up, positive powers truncated.
+ */
+static const uint64_t power_of_five_128[] = {
+    0xa87fea27a539e9a5u, 0x3f2398d747b36224u,
+    0xd29fe4b18e88640eu, 0x8eec7f0d19a03aadu,
+    0x83a3eeeef9153e89u, 0x1953cf68300424acu,
+    0xa48ceaaab75a8e2bu, 0x5fa8c3423c052dd7u,
+    0xcdb02555653131b6u, 0x3792f412cb06794du,
+    0x808e17555f3ebf11u, 0xe2bbd88bbee40bd0u,
+    0xa0b19d2ab70e6ed6u, 0x5b6aceaeae9d0ec4u,
+    0xc8de047564d20a8bu, 0xf245825a5a445275u,
+    0xfb158592be068d2eu, 0xeed6e2f0f0d56712u,
+    0x9ced737bb6c4183du, 0x55464dd69685606bu,
+    0xc428d05aa4751e4cu, 0xaa97e14c3c26b886u,
+    0xf53304714d9265dfu, 0xd53dd99f4b3066a8u,
+    0x993fe2c6d07b7fabu, 0xe546a8038efe4029u,
+    0xbf8fdb78849a5f96u, 0xde98520472bdd033u,
+    0xef73d256a5c0f77cu, 0x963e66858f6d4440u,
+    0x95a8637627989aadu, 0xdde7001379a44aa8u,
+    0xbb127c53b17ec159u, 0x5560c018580d5d52u,
+    0xe9d71b689dde71afu, 0xaab8f01e6e10b4a6u,
+    0x9226712162ab070du, 0xcab3961304ca70e8u,
+    0xb6b00d69bb55c8d1u, 0x3d607b97c5fd0d22u,
+    0xe45c10c42a2b3b05u, 0x8cb89a7db77c506au,
+    0x8eb98a7a9a5b04e3u, 0x77f3608e92adb242u,
+    0xb267ed1940f1c61cu, 0x55f038b237591ed3u,
+    0xdf01e85f912e37a3u, 0x6b6c46dec52f6688u,
+    0x8b61313bbabce2c6u, 0x2323ac4b3b3da015u,
+    0xae397d8aa96c1b77u, 0xabec975e0a0d081au,
+    0xd9c7dced53c72255u, 0x96e7bd358c904a21u,
+    0x881cea14545c7575u, 0x7e50d64177da2e54u,
+    0xaa242499697392d2u, 0xdde50bd1d5d0b9e9u,
+    0xd4ad2dbfc3d07787u, 0x955e4ec64b44e864u,
+    0x84ec3c97da624ab4u, 0xbd5af13bef0b113eu,
+    0xa6274bbdd0fadd61u, 0xecb1ad8aeacdd58eu,
+    0xcfb11ead453994bau, 0x67de18eda5814af2u,
+    0x81ceb32c4b43fcf4u, 0x80eacf948770ced7u,
+    0xa2425ff75e14fc31u, 0xa1258379a94d028du,
+    0xcad2f7f5359a3b3eu, 0x096ee45813a04330u,
+    0xfd87b5f28300ca0du, 0x8bca9d6e188853fcu,
+    0x9e74d1b791e07e48u, 0x775ea264cf55347eu,
+    0xc612062576589ddau, 0x95364afe032a819eu,
+    0xf79687aed3eec551u, 0x3a83ddbd83f52205u,
+    0x9abe14cd44753b52u, 0xc4926a9672793543u,
+    0xc16d9a0095928a27u, 0x75b7053c0f178294u,
+    0xf1c90080baf72cb1u, 0x5324c68b12dd6339u,
+    0x971da05074da7beeu, 0xd3f6fc16ebca5e04u,
+    0xbce5086492111aeau, 0x88f4bb1ca6bcf585u,
+    0xec1e4a7db69561a5u, 0x2b31e9e3d06c32e6u,
+    0x9392ee8e921d5d07u, 0x3aff322e62439fd0u,
+    0xb877aa3236a4b449u, 0x09befeb9fad487c3u,
+    0xe69594bec44de15bu, 0x4c2ebe687989a9b4u,
+    0x901d7cf73ab0acd9u, 0x0f9d37014bf60a11u,
+    0xb424dc35095cd80fu, 0x538484c19ef38c95u,
+    0xe12e13424bb40e13u, 0x2865a5f206b06fbau,
+    0x8cbccc096f5088cbu, 0xf93f87b7442e45d4u,
+    0xafebff0bcb24aafeu, 0xf78f69a51539d749u,
+    0xdbe6fecebdedd5beu, 0xb573440e5a884d1cu,
+    0x89705f4136b4a597u, 0x31680a88f8953031u,
+    0xabcc77118461cefcu, 0xfdc20d2b36ba7c3eu,
+    0xd6bf94d5e57a42bcu, 0x3d32907604691b4du,
+    0x8637bd05af6c69b5u, 0xa63f9a49c2c1b110u,
+    0xa7c5ac471b478423u, 0x0fcf80dc33721d54u,
+    0xd1b71758e219652bu, 0xd3c36113404ea4a9u,
+    0x83126e978d4fdf3bu, 0x645a1cac083126eau,
+    0xa3d70a3d70a3d70au, 0x3d70a3d70a3d70a4u,
+    0xccccccccccccccccu, 0xcccccccccccccccdu,
+    0x8000000000000000u, 0x0000000000000000u,
+    0xa000000000000000u, 0x0000000000000000u,
+    0xc800000000000000u, 0x0000000000000000u,
+    0xfa00000000000000u, 0x0000000000000000u,
+    0x9c40000000000000u, 0x0000000000000000u,
+    0xc350000000000000u, 0x0000000000000000u,
+    0xf424000000000000u, 0x0000000000000000u,
+    0x9896800000000000u, 0x0000000000000000u,
+    0xbebc200000000000u, 0x0000000000000000u,
+    0xee6b280000000000u, 0x0000000000000000u,
+    0x9502f90000000000u, 0x0000000000000000u,
+    0xba43b74000000000u, 0x0000000000000000u,
+    0xe8d4a51000000000u, 0x0000000000000000u,
+    0x9184e72a00000000u, 0x0000000000000000u,
+    0xb5e620f480000000u, 0x0000000000000000u,
+    0xe35fa931a0000000u, 0x0000000000000000u,
+    0x8e1bc9bf04000000u, 0x0000000000000000u,
+    0xb1a2bc2ec5000000u, 0x0000000000000000u,
+    0xde0b6b3a76400000u, 0x0000000000000000u,
+    0x8ac7230489e80000u, 0x0000000000000000u,
+    0xad78ebc5ac620000u, 0x0000000000000000u,
+    0xd8d726b7177a8000u, 0x0000000000000000u,
+    0x878678326eac9000u, 0x0000000000000000u,
+    0xa968163f0a57b400u, 0x0000000000000000u,
+    0xd3c21bcecceda100u, 0x0000000000000000u,
+    0x84595161401484a0u, 0x0000000000000000u,
+    0xa56fa5b99019a5c8u, 0x0000000000000000u,
+    0xcecb8f27f4200f3au, 0x0000000000000000u,
+    0x813f3978f8940984u, 0x4000000000000000u,
+    0xa18f07d736b90be5u, 0x5000000000000000u,
+    0xc9f2c9cd04674edeu, 0xa400000000000000u,
+    0xfc6f7c4045812296u, 0x4d00000000000000u,
+    0x9dc5ada82b70b59du, 0xf020000000000000u,
+    0xc5371912364ce305u, 0x6c28000000000000u,
+    0xf684df56c3e01bc6u, 0xc732000000000000u,
+    0x9a130b963a6c115cu, 0x3c7f400000000000u,
+    0xc097ce7bc90715b3u, 0x4b9f100000000000u,
+    0xf0bdc21abb48db20u, 0x1e86d40000000000u,
+    0x96769950b50d88f4u, 0x1314448000000000u
+};
+
+static inline uint64_t multiply_128(uint64_t a, uint64_t b, uint64_t* low)
+{
+#if defined(__SIZEOF_INT128__)
+    __extension__ typedef unsigned __int128 uint128_t;
+    uint128_t product = (uint128_t)(a) * b;
+    *low = (uint64_t)(product);
+    return (uint64_t)(product >> 64);
+#else
+    uint64_t a_lo = (uint32_t)(a), a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)(b), b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo;
+    uint64_t hi_lo = a_hi * b_lo;
+    uint64_t lo_hi = a_lo * b_hi;
+    uint64_t hi_hi = a_hi * b_hi;
+    uint64_t cross = (lo_lo >> 32) + (uint32_t)(hi_lo) + lo_hi;
+    *low = (cross << 32) | (uint32_t)(lo_lo);
+    return (hi_lo >> 32) + (cross >> 32) + hi_hi;
+#endif
+}
+
+static inline int leading_zeroes(uint64_t value)
+{
+#if defined(__GNUC__)
+    return __builtin_clzll(value);
+#else
+    int count = 0;
+    while((value & (UINT64_C(1) << 63)) == 0) {
+        value <<= 1;
+        ++count;
+    }
+
+    return count;
+#endif
+}
+
+/*
+ * Computes the binary32 bit pattern nearest to w * 10^q (Eisel-Lemire).
+ */
+static uint32_t compute_float(int q, uint64_t w)
+{
+    if(w == 0 || q < SMALLEST_POWER_OF_TEN)
+        return 0;
+    if(q > LARGEST_POWER_OF_TEN) {
+        return UINT32_C(0xFF) << 23;
+    }
+
+    int lz = leading_zeroes(w);
+    w <<= lz;
+
+    const uint64_t* power = &power_of_five_128[2 * (q - SMALLEST_POWER_OF_TEN)];
+    uint64_t low;
+    uint64_t high = multiply_128(w, power[0], &low);
+    const uint64_t precision_mask = UINT64_MAX >> 26;
+    if((high & precision_mask) == precision_mask) {
+        uint64_t second_low;
+        uint64_t second_high = multiply_128(w, power[1], &second_low);
+        low += second_high;
+        if(second_high > low) {
+            high++;
+        }
+    }
+
+    int upperbit = (int)(high >> 63);
+    int shift = upperbit + 64 - 23 - 3;
+    uint64_t mantissa = high >> shift;
+    int power2 = (((152170 + 65536) * q) >> 16) + 63 + upperbit - lz + 127;
+    if(power2 <= 0) {
+        if(-power2 + 1 >= 64)
+            return 0;
+        mantissa >>= -power2 + 1;
+        mantissa += (mantissa & 1);
+        mantissa >>= 1;
+        power2 = (mantissa < (UINT64_C(1) << 23)) ? 0 : 1;
+        return (uint32_t)(mantissa & ~(UINT64_C(1) << 23)) | ((uint32_t)(power2) << 23);
+    }
+
+    if(low <= 1 && q >= -17 && q <= 10 && (mantissa & 3) == 1) {
+        if((mantissa << shift) == high) {
+            mantissa &= ~UINT64_C(1);
+        }
+    }
+
+    mantissa += (mantissa & 1);
+    mantissa >>= 1;
+    if(mantissa >= (UINT64_C(2) << 23)) {
+        mantissa = (UINT64_C(1) << 23);
+        power2++;
+    }
+
+    mantissa &= ~(UINT64_C(1) << 23);
+    if(power2 >= 0xFF)
+        return UINT32_C(0xFF) << 23;
+    return (uint32_t)(mantissa) | ((uint32_t)(power2) << 23);
+}
+
+#define MAX_FALLBACK_DIGITS 120
+
+static float parse_float_fallback(const char* it, const char* end, int exponent)
+{
+    char buffer[MAX_FALLBACK_DIGITS + 24];
+    int length = 0;
+    bool fraction = false;
+    bool truncated = false;
+    for(; it < end; ++it) {
+        if(*it == '.') {
+            fraction = true;
+        } else if(length == 0 && *it == '0') {
+            if(fraction) {
+                --exponent;
+            }
+        } else if(length < MAX_FALLBACK_DIGITS) {
+            buffer[length++] = *it;
+            if(fraction) {
+                --exponent;
+            }
+        } else {
+            if(*it != '0')
+                truncated = true;
+            if(!fraction) {
+                ++exponent;
+            }
+        }
+    }
+
+    if(truncated) {
+        buffer[length++] = '1';
+        --exponent;
+    }
+
+    if(length == 0)
+        return 0.f;
+    snprintf(buffer + length, sizeof(buffer) - length, "e%d", exponent);
+    return strtof(buffer, NULL);
+}
+
+#define MAX_EXPONENT 100000
+
+#if FLT_EVAL_METHOD == 0
+static const float powers_of_ten[] = {
+    1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+};
+#endif
+
 static inline bool parse_float(const char** begin, const char* end, float* number)
 {
     const char* it = *begin;
-    float integer = 0;
-    float fraction = 0;
-    float exponent = 0;
-    int sign = 1;
-    int expsign = 1;
-
+    bool negative = false;
     if(it < end && *it == '+')
         ++it;
     else if(it < end && *it == '-') {
         ++it;
-        sign = -1;
+        negative = true;
     }
 
     if(it >= end || (*it != '.' && !IS_NUM(*it)))
         return false;
-    if(IS_NUM(*it)) {
-        do {
-            integer = 10.f * integer + (*it++ - '0');
-        } while(it < end && IS_NUM(*it));
+    const char* digits = it;
+    uint64_t mantissa = 0;
+    int count = 0;
+    int exponent = 0;
+    bool truncated = false;
+    while(it < end && IS_NUM(*it)) {
+        if(count < 19) {
+            mantissa = 10 * mantissa + (*it - '0');
+            if(mantissa) {
+                ++count;
+            }
+        } else {
+            if(*it != '0')
+                truncated = true;
+            ++exponent;
+        }
+
+        ++it;
     }
 
     if(it < end && *it == '.') {
         ++it;
         if(it >= end || !IS_NUM(*it))
             return false;
-        float divisor = 1.f;
         do {
-            fraction = 10.f * fraction + (*it++ - '0');
-            divisor *= 10.f;
+            if(count < 19) {
+                mantissa = 10 * mantissa + (*it - '0');
+                if(mantissa)
+                    ++count;
+                --exponent;
+            } else if(*it != '0') {
+                truncated = true;
+            }
+
+            ++it;
         } while(it < end && IS_NUM(*it));
-        fraction /= divisor;
     }
 
+    const char* digits_end = it;
+    int explicit_exponent = 0;
     if(it + 1 < end && (it[0] == 'e' || it[0] == 'E') && (it[1] != 'x' && it[1] != 'm')) {
         ++it;
+        int expsign = 1;
         if(it < end && *it == '+')
             ++it;
         else if(it < end && *it == '-') {
@@ -498,14 +1008,37 @@ static inline bool parse_float(const char** begin, const char* end, float* numbe
         if(it >= end || !IS_NUM(*it))
             return false;
         do {
-            exponent = 10 * exponent + (*it++ - '0');
+            if(explicit_exponent < MAX_EXPONENT)
+                explicit_exponent = 10 * explicit_exponent + (*it - '0');
+            ++it;
         } while(it < end && IS_NUM(*it));
+        explicit_exponent *= expsign;
+    }
+
+    exponent += explicit_exponent;
+
+    float value;
+#if FLT_EVAL_METHOD == 0
+    if(!truncated && mantissa <= (UINT64_C(1) << 24) && exponent >= -10 && exponent <= 10) {
+        value = (float)(mantissa);
+        if(exponent < 0) {
+            value /= powers_of_ten[-exponent];
+        } else {
+            value *= powers_of_ten[exponent];
+        }
+    } else
+#endif
+    {
+        uint32_t bits = compute_float(exponent, mantissa);
+        if(truncated && bits != compute_float(exponent, mantissa + 1)) {
+            value = parse_float_fallback(digits, digits_end, explicit_exponent);
+        } else {
+            memcpy(&value, &bits, sizeof(value));
+        }
     }
 
     *begin = it;
-    *number = sign * (integer + fraction);
-    if(exponent)
-        *number *= powf(10.f, expsign * exponent);
+    *number = negative ? -value : value;
     return *number >= -FLT_MAX && *number <= FLT_MAX;
 }
 
@@ -525,12 +1058,27 @@ static inline bool skip_string(const char** begin, const char* end, const char*
     return false;
 }
 
+static inline const char* find_delim(const char* it, const char* end, const char delim)
+{
+    if(it >= end)
+        return end;
+    const char* found = memchr(it, delim, end - it);
+    if(found == NULL)
+        return end;
+    return found;
+}
+
 static inline const char* string_find(const char* it, const char* end, const char* data)
 {
+    const size_t length = strlen(data);
     while(it < end) {
-        const char* begin = it;
-        if(skip_string(&it, end, data))
-            return begin;
+        it = memchr(it, data[0], end - it);
+        if(it == NULL)
+            break;
+        if((size_t)(end - it) < length)
+            break;
+        if(memcmp(it, data, length) == 0)
+            return it;
         ++it;
     }
 
@@ -590,7 +1138,9 @@ static inline const char* rtrim(const char* begin, const char* end)
 
 static bool parse_number(const element_t* element, int id, float* number, bool percent, bool inherit)
 {
-    const string_t* value = find_attribute(element, id, inherit);
+    const string_t* value;
+    if(find_property(element, id, inherit, number, sizeof(*number), &value))
+        return true;
     if(value == NULL)
         return false;
     const char* it = value->data;
@@ -692,7 +1242,9 @@ static bool parse_length_value(const char** begin, const char* end, length_t* le
 
 static bool parse_length(const element_t* element, int id, length_t* length, bool negative, bool inherit)
 {
-    const string_t* value = find_attribute(element, id, inherit);
+    const string_t* value;
+    if(find_property(element, id, inherit, length, sizeof(*length), &value))
+        return true;
     if(value == NULL)
         return false;
     const char* it = value->data;
@@ -755,7 +1307,9 @@ static bool parse_color_value(const char** begin, const char* end, color_t* colo
 
 static bool parse_color(const element_t* element, int id, color_t* color, bool inherit)
 {
-    const string_t* value = find_attribute(element, id, inherit);
+    const string_t* value;
+    if(find_property(element, id, inherit, color, sizeof(*color), &value))
+        return true;
     if(value == NULL)
         return false;
     const char* it = value->data;
@@ -796,7 +1350,9 @@ static bool parse_url_value(const char** begin, const char* end, string_t* id)
 
 static bool parse_paint(const element_t* element, int id, paint_t* paint)
 {
-    const string_t* value = find_attribute(element, id, true);
+    const string_t* value;
+    if(find_property(element, id, true, paint, sizeof(*paint), &value))
+        return true;
     if(value == NULL)
         return false;
     const char* it = value->data;
@@ -855,7 +1411,9 @@ static bool parse_paint(const element_t* element, int id, paint_t* paint)
 
 static bool parse_view_box(const element_t* element, int id, plutovg_rect_t* view_box)
 {
-    const string_t* value = find_attribute(element, id, false);
+    const string_t* value;
+    if(find_property(element, id, false, view_box, sizeof(*view_box), &value))
+        return true;
     if(value == NULL)
         return false;
     const char* it = value->data;
@@ -907,7 +1465,9 @@ typedef struct {
 
 static bool parse_view_position(const element_t* element, int id, view_position_t* position)
 {
-    const string_t* value = find_attribute(element, id, false);
+    const string_t* value;
+    if(find_property(element, id, false, position, sizeof(*position), &value))
+        return true;
     if(value == NULL)
         return false;
     const char* it = value->data;
@@ -949,7 +1509,9 @@ static bool parse_view_position(const element_t* element, int id, view_position_
 
 static bool parse_transform(const element_t* element, int id, plutovg_matrix_t* matrix)
 {
-    const string_t* value = find_attribute(element, id, false);
+    const string_t* value;
+    if(find_property(element, id, false, matrix, sizeof(*matrix), &value))
+        return true;
     if(value == NULL)
         return false;
     return plutovg_matrix_parse(matrix, value->data, value->length);
@@ -1000,9 +1562,21 @@ typedef struct {
     size_t size;
 } stroke_dash_array_t;
 
+typedef struct {
+    const length_t* data;
+    size_t size;
+} compiled_dash_array_t;
+
 static bool parse_dash_array(const element_t* element, int id, stroke_dash_array_t* dash_array)
 {
-    const string_t* value = find_attribute(element, id, true);
+    compiled_dash_array_t compiled;
+    const string_t* value;
+    if(find_property(element, id, true, &compiled, sizeof(compiled), &value)) {
+        for(size_t i = 0; i < compiled.size && dash_array->size < MAX_DASHES; ++i)
+            dash_array->data[dash_array->size++] = compiled.data[i];
+        return true;
+    }
+
     if(value == NULL)
         return false;
     const char* it = value->data;
@@ -1019,7 +1593,9 @@ static bool parse_dash_array(const element_t* element, int id, stroke_dash_array
 
 static bool parse_line_cap(const element_t* element, int id, plutovg_line_cap_t* line_cap)
 {
-    const string_t* value = find_attribute(element, id, true);
+    const string_t* value;
+    if(find_property(element, id, true, line_cap, sizeof(*line_cap), &value))
+        return true;
     if(value == NULL)
         return false;
     const char* it = value->data;
@@ -1035,7 +1611,9 @@ static bool parse_line_cap(const element_t* element, int id, plutovg_line_cap_t*
 
 static bool parse_line_join(const element_t* element, int id, plutovg_line_join_t* line_join)
 {
-    const string_t* value = find_attribute(element, id, true);
+    const string_t* value;
+    if(find_property(element, id, true, line_join, sizeof(*line_join), &value))
+        return true;
     if(value == NULL)
         return false;
     const char* it = value->data;
@@ -1051,7 +1629,9 @@ static bool parse_line_join(const element_t* element, int id, plutovg_line_join_
 
 static bool parse_fill_rule(const element_t* element, int id, plutovg_fill_rule_t* fill_rule)
 {
-    const string_t* value = find_attribute(element, id, true);
+    const string_t* value;
+    if(find_property(element, id, true, fill_rule, sizeof(*fill_rule), &value))
+        return true;
     if(value == NULL)
         return false;
     const char* it = value->data;
@@ -1065,7 +1645,9 @@ static bool parse_fill_rule(const element_t* element, int id, plutovg_fill_rule_
 
 static bool parse_spread_method(const element_t* element, int id, plutovg_spread_method_t* spread_method)
 {
-    const string_t* value = find_attribute(element, id, false);
+    const string_t* value;
+    if(find_property(element, id, false, spread_method, sizeof(*spread_method), &value))
+        return true;
     if(value == NULL)
         return false;
     const char* it = value->data;
@@ -1086,7 +1668,9 @@ typedef enum {
 
 static bool parse_display(const element_t* element, int id, display_t* display)
 {
-    const string_t* value = find_attribute(element, id, false);
+    const string_t* value;
+    if(find_property(element, id, false, display, sizeof(*display), &value))
+        return true;
     if(value == NULL)
         return false;
     const char* it = value->data;
@@ -1106,7 +1690,9 @@ typedef enum {
 
 static bool parse_visibility(const element_t* element, int id, visibility_t* visibility)
 {
-    const string_t* value = find_attribute(element, id, true);
+    const string_t* value;
+    if(find_property(element, id, true, visibility, sizeof(*visibility), &value))
+        return true;
     if(value == NULL)
         return false;
     const char* it = value->data;
@@ -1127,7 +1713,9 @@ typedef enum {
 
 static bool parse_units_type(const element_t* element, int id, units_type_t* units_type)
 {
-    const string_t* value = find_attribute(element, id, false);
+    const string_t* value;
+    if(find_property(element, id, false, units_type, sizeof(*units_type), &value))
+        return true;
     if(value == NULL)
         return false;
     const char* it = value->data;
@@ -1139,57 +1727,454 @@ static bool parse_units_type(const element_t* element, int id, units_type_t* uni
     return !skip_ws(&it, end);
 }
 
-struct plutosvg_document {
-    heap_t* heap;
-    plutovg_path_t* path;
-    hashmap_t* id_cache;
-    element_t* root_element;
-    plutovg_destroy_func_t destroy_func;
-    void* closure;
-    float width;
-    float height;
-};
-
-static plutosvg_document_t* plutosvg_document_create(float width, float height, plutovg_destroy_func_t destroy_func, void* closure)
+typedef struct image_entry {
+    const element_t* element;
+    plutovg_surface_t* surface;
+    int width;
+    int height;
+    int reduction;
+    size_t size;
+    struct image_entry* next;
+} image_entry_t;
+
+typedef struct {
+    image_entry_t* entries;
+    size_t limit;
+    mutex_t lock;
+} image_cache_t;
+
+static image_cache_t* image_cache_create(void)
+{
+    image_cache_t* cache = malloc(sizeof(image_cache_t));
+    if(cache == NULL)
+        return NULL;
+    cache->entries = NULL;
+    cache->limit = SIZE_MAX;
+    mutex_init(&cache->lock);
+    return cache;
+}
+
+static void image_cache_trim(image_cache_t* cache)
+{
+    size_t size = 0;
+    image_entry_t** it = &cache->entries;
+    while(*it) {
+        image_entry_t* entry = *it;
+        if(entry->size > cache->limit - size) {
+            *it = entry->next;
+            plutovg_surface_destroy(entry->surface);
+            free(entry);
+        } else {
+            size += entry->size;
+            it = &entry->next;
+        }
+    }
+}
+
+static void image_cache_destroy(image_cache_t* cache)
+{
+    image_entry_t* entry = cache->entries;
+    while(entry) {
+        image_entry_t* next = entry->next;
+        plutovg_surface_destroy(entry->surface);
+        free(entry);
+        entry = next;
+    }
+
+    mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+#define STYLE_MASK (ATTRIBUTE_BIT(ATTR_COLOR) | ATTRIBUTE_BIT(ATTR_FILL) | ATTRIBUTE_BIT(ATTR_FILL_OPACITY) \
+    | ATTRIBUTE_BIT(ATTR_FILL_RULE) | ATTRIBUTE_BIT(ATTR_STROKE) | ATTRIBUTE_BIT(ATTR_STROKE_DASHARRAY) \
+    | ATTRIBUTE_BIT(ATTR_STROKE_DASHOFFSET) | ATTRIBUTE_BIT(ATTR_STROKE_LINECAP) | ATTRIBUTE_BIT(ATTR_STROKE_LINEJOIN) \
+    | ATTRIBUTE_BIT(ATTR_STROKE_MITERLIMIT) | ATTRIBUTE_BIT(ATTR_STROKE_OPACITY) | ATTRIBUTE_BIT(ATTR_STROKE_WIDTH) \
+    | ATTRIBUTE_BIT(ATTR_VISIBILITY))
+#define STYLE_COUNT 13
+
+#define STYLE_INDEX(id) popcount(STYLE_MASK & (ATTRIBUTE_BIT(id) - 1))
+
+/*
+ * Computed inherited properties: for each property in STYLE_MASK, the element whose attribute applies,
+ * or NULL when no element in the inheritance chain sets it. Every element gets its style at load time, in
+ * the context of its own ancestors; records are shared by every element that sets none of these
+ * properties itself.
+ */
+typedef struct style {
+    const element_t* sources[STYLE_COUNT];
+} style_t;
+
+static inline uint64_t style_mask(const element_t* element)
+{
+    return element->attribute_mask & ~element->inherit_mask & STYLE_MASK;
+}
+
+/*
+ * Computes into `style` the style of an element that inherits `base`; returns `base` itself when the
+ * element sets none of the properties, leaving `style` untouched.
+ */
+static const style_t* inherit_style(style_t* style, const style_t* base, const element_t* element)
+{
+    uint64_t mask = style_mask(element);
+    if(mask == 0)
+        return base;
+    if(base) {
+        *style = *base;
+    } else {
+        memset(style, 0, sizeof(style_t));
+    }
+
+    while(mask) {
+        const uint64_t bit = mask & (~mask + 1);
+        mask &= mask - 1;
+        style->sources[popcount(STYLE_MASK & (bit - 1))] = element;
+    }
+
+    return style;
+}
+
+typedef struct {
+    float view_width;
+    float view_height;
+    plutovg_rect_t bounds;
+} bounds_entry_t;
+
+/*
+ * Bounds measured while rendering, one slot per element: the bounds of its children in its own user space
+ * when rendered with the style computed at load time, and its extents as returned by
+ * plutosvg_document_element_extents. Entries are built outside of any lock, stored once under the document
+ * lock and never changed, so renders read them with an acquire load and take no lock once they are known.
+ */
+typedef struct {
+    const bounds_entry_t* children;
+    const plutovg_rect_t* extents;
+} bounds_slot_t;
+
+struct plutosvg_document {
+    plutosvg_arena_t* arena;
+    bool owns_arena;
+    mutex_t lock;
+    mutex_t materialize_lock;
+    id_index_t id_index;
+    image_cache_t* image_cache;
+    bounds_slot_t* bounds_slots;
+    element_t* elements;
+    size_t element_count;
+    size_t element_capacity;
+    size_t pruned_count;
+    element_t* root_element;
+    plutovg_destroy_func_t destroy_func;
+    void* closure;
+    float width;
+    float height;
+    int flags;
+    int pending_subtrees;
+};
+
+static plutosvg_document_t* plutosvg_document_create(float width, float height, plutosvg_arena_t* arena, size_t length, plutovg_destroy_func_t destroy_func, void* closure)
 {
     plutosvg_document_t* document = malloc(sizeof(plutosvg_document_t));
-    document->heap = heap_create();
-    document->path = plutovg_path_create();
-    document->id_cache = NULL;
+    if(document == NULL)
+        return NULL;
+    document->arena = arena ? arena : arena_create(length, false);
+    document->owns_arena = arena == NULL;
+    document->image_cache = image_cache_create();
+    if(document->arena == NULL || document->image_cache == NULL) {
+        if(document->image_cache)
+            image_cache_destroy(document->image_cache);
+        if(document->owns_arena)
+            plutosvg_arena_destroy(document->arena);
+        free(document);
+        return NULL;
+    }
+
+    mutex_init(&document->lock);
+    mutex_init(&document->materialize_lock);
+    id_index_init(&document->id_index);
+    document->bounds_slots = NULL;
+    document->elements = NULL;
+    document->element_count = 0;
+    document->element_capacity = 0;
+    document->pruned_count = 0;
     document->root_element = NULL;
     document->destroy_func = destroy_func;
     document->closure = closure;
     document->width = width;
     document->height = height;
+    document->flags = PLUTOSVG_LOAD_FLAGS_NONE;
+    document->pending_subtrees = 0;
     return document;
 }
 
+/*
+ * Returns the geometry of a path, polyline or polygon element, building it on first use. Once built it is
+ * read without a lock; only the first renders of an element take the document lock.
+ */
+static const shape_t* resolve_shape(const plutosvg_document_t* document, const element_t* element)
+{
+    const shape_t* shape = atomic_load_ptr(&element->shape);
+    if(shape)
+        return shape;
+    mutex_lock(&document->lock);
+    if((shape = element->shape) == NULL) {
+        shape_t* newshape = arena_alloc(document->arena, sizeof(shape_t));
+        newshape->path = plutovg_path_create();
+        if(element->id == TAG_PATH) {
+            parse_path(element, ATTR_D, newshape->path);
+        } else {
+            parse_points(element, ATTR_POINTS, newshape->path);
+        }
+
+        plutovg_path_extents(newshape->path, &newshape->extents, false);
+        atomic_store_ptr(&((element_t*)(element))->shape, newshape);
+        shape = newshape;
+    }
+
+    mutex_unlock(&document->lock);
+    return shape;
+}
+
+/*
+ * Moves the element array to a block of `capacity` elements. Element links are relative and move with
+ * the array; the root and the id index are rebased here, any other element pointer is left dangling.
+ */
+static bool resize_elements(plutosvg_document_t* document, size_t capacity)
+{
+    if(capacity < document->element_count || capacity > INT32_MAX)
+        return false;
+    element_t* elements = malloc(MAX(capacity, 1) * sizeof(element_t));
+    if(elements == NULL)
+        return false;
+    if(document->element_count > 0)
+        memcpy(elements, document->elements, document->element_count * sizeof(element_t));
+    for(size_t i = 0; i < document->id_index.capacity; ++i) {
+        id_slot_t* slot = document->id_index.slots + i;
+        if(slot->element) {
+            slot->element = elements + (slot->element - document->elements);
+        }
+    }
+
+    if(document->root_element)
+        document->root_element = elements;
+    free(document->elements);
+    document->elements = elements;
+    document->element_capacity = capacity;
+    return true;
+}
+
 void plutosvg_document_destroy(plutosvg_document_t* document)
 {
     if(document == NULL)
         return;
-    plutovg_path_destroy(document->path);
-    hashmap_destroy(document->id_cache);
-    heap_destroy(document->heap);
+    for(size_t i = 0; i < document->element_count; ++i) {
+        const element_t* element = document->elements + i;
+        if(element->shape) {
+            plutovg_path_destroy(element->shape->path);
+        }
+    }
+
+    free(document->elements);
+    mutex_destroy(&document->lock);
+    mutex_destroy(&document->materialize_lock);
+    free(document->id_index.slots);
+    free(document->bounds_slots);
+    image_cache_destroy(document->image_cache);
+    if(document->owns_arena)
+        plutosvg_arena_destroy(document->arena);
     if(document->destroy_func)
         document->destroy_func(document->closure);
     free(document);
 }
 
-static void add_attribute(element_t* element, plutosvg_document_t* document, int id, const char* data, size_t length)
+/*
+ * Appends an element to the document; returns NULL when the element array is full.
+ */
+static element_t* create_element(plutosvg_document_t* document, element_t* parent, int id)
+{
+    if(document->element_count == document->element_capacity)
+        return NULL;
+    element_t* element = document->elements + document->element_count++;
+    element->id = id;
+    element->parent = parent ? (int32_t)(parent - element) : 0;
+    element->next_sibling = 0;
+    element->first_child = 0;
+    element->last_child = 0;
+    element->attribute_count = 0;
+    element->attributes = NULL;
+    element->attribute_mask = 0;
+    element->inherit_mask = 0;
+    element->property_mask = 0;
+    element->properties = NULL;
+    element->style = NULL;
+    element->shape = NULL;
+    element->subtree = NULL;
+    if(parent == NULL) {
+        document->root_element = element;
+    } else if(parent->last_child) {
+        element_t* last_child = element_link(parent, parent->last_child);
+        last_child->next_sibling = (int32_t)(element - last_child);
+        parent->last_child = (int32_t)(element - parent);
+    } else {
+        parent->last_child = (int32_t)(element - parent);
+        parent->first_child = parent->last_child;
+    }
+
+    return element;
+}
+
+static void add_attribute(element_t* element, attribute_t* attribute, int id, const char* data, size_t length)
 {
-    attribute_t* attribute = heap_alloc(document->heap, sizeof(attribute_t));
     attribute->id = id;
     attribute->value.data = data;
     attribute->value.length = length;
-    attribute->next = element->attributes;
-    element->attributes = attribute;
+    element->attribute_mask |= ATTRIBUTE_BIT(id);
+    if(length == 7 && strncmp(data, "inherit", 7) == 0) {
+        element->inherit_mask |= ATTRIBUTE_BIT(id);
+    } else {
+        element->inherit_mask &= ~ATTRIBUTE_BIT(id);
+    }
+}
+
+struct plutosvg_parser {
+    plutosvg_document_t* document;
+    element_t* current;
+    int ignoring;
+    int flags;
+    bool copy;
+    bool started;
+    bool probing;
+    bool splitting;
+    bool failed;
+    char* buffer;
+    size_t size;
+    size_t capacity;
+    size_t scan_offset;
+    char scan_quote;
+    int scan_depth;
+    element_t* skipping;
+    element_t* materializing;
+    int* skip_stack;
+    int skip_depth;
+    int skip_capacity;
+    attribute_t* attributes;
+    uint32_t attribute_count;
+    uint32_t attribute_capacity;
+};
+
+static void parser_init(plutosvg_parser_t* parser, plutosvg_document_t* document, int flags, bool copy)
+{
+    parser->document = document;
+    parser->current = NULL;
+    parser->ignoring = 0;
+    parser->flags = flags;
+    parser->copy = copy;
+    parser->started = false;
+    parser->probing = false;
+    parser->splitting = false;
+    parser->failed = false;
+    parser->buffer = NULL;
+    parser->size = 0;
+    parser->capacity = 0;
+    parser->scan_offset = 0;
+    parser->scan_quote = 0;
+    parser->scan_depth = 0;
+    parser->skipping = NULL;
+    parser->materializing = NULL;
+    parser->skip_stack = NULL;
+    parser->skip_depth = 0;
+    parser->skip_capacity = 0;
+    parser->attributes = NULL;
+    parser->attribute_count = 0;
+    parser->attribute_capacity = 0;
+}
+
+static void parser_push_skip(plutosvg_parser_t* parser, int id)
+{
+    if(parser->skip_depth == parser->skip_capacity) {
+        int capacity = parser->skip_capacity == 0 ? 16 : parser->skip_capacity * 2;
+        int* stack = arena_alloc(parser->document->arena, capacity * sizeof(int));
+        if(parser->skip_depth > 0)
+            memcpy(stack, parser->skip_stack, parser->skip_depth * sizeof(int));
+        parser->skip_stack = stack;
+        parser->skip_capacity = capacity;
+    }
+
+    parser->skip_stack[parser->skip_depth++] = id;
+}
+
+/*
+ * Creates a child of the current element, growing the element array when needed. Materializing a lazy
+ * subtree never grows it: the array was sized for every start tag in the source, and growing would move
+ * elements that are being rendered.
+ */
+static element_t* parser_create_element(plutosvg_parser_t* parser, int id)
+{
+    plutosvg_document_t* document = parser->document;
+    if(document->element_count == document->element_capacity && parser->materializing == NULL) {
+        size_t current = parser->current ? parser->current - document->elements : 0;
+        size_t skipping = parser->skipping ? parser->skipping - document->elements : 0;
+        if(!resize_elements(document, MAX(64, document->element_capacity * 2)))
+            return NULL;
+        if(parser->current)
+            parser->current = document->elements + current;
+        if(parser->skipping) {
+            parser->skipping = document->elements + skipping;
+        }
+    }
+
+    return create_element(document, parser->current, id);
+}
+
+static bool is_subtree_owner(const plutosvg_document_t* document, const element_t* owner, const element_t* element)
+{
+    if(element == NULL)
+        return true;
+    while(element->parent && element_parent(element) != document->root_element)
+        element = element_parent(element);
+    return element == owner;
+}
+
+static const char* parser_retain(plutosvg_parser_t* parser, const char* data, size_t length)
+{
+    if(!parser->copy || length == 0)
+        return data;
+    char* copy = arena_alloc(parser->document->arena, length);
+    memcpy(copy, data, length);
+    return copy;
+}
+
+/*
+ * Attributes are collected here while a start tag is parsed, then copied to the element in one block.
+ */
+static void parser_add_attribute(plutosvg_parser_t* parser, element_t* element, int id, const char* data, size_t length)
+{
+    if(parser->attribute_count == parser->attribute_capacity) {
+        uint32_t capacity = parser->attribute_capacity == 0 ? 16 : parser->attribute_capacity * 2;
+        attribute_t* attributes = arena_alloc(parser->document->arena, capacity * sizeof(attribute_t));
+        if(parser->attribute_count > 0)
+            memcpy(attributes, parser->attributes, parser->attribute_count * sizeof(attribute_t));
+        parser->attributes = attributes;
+        parser->attribute_capacity = capacity;
+    }
+
+    add_attribute(element, parser->attributes + parser->attribute_count++, id, data, length);
+}
+
+static void parser_commit_attributes(plutosvg_parser_t* parser, element_t* element)
+{
+    if(parser->attribute_count == 0)
+        return;
+    attribute_t* attributes = arena_alloc(parser->document->arena, parser->attribute_count * sizeof(attribute_t));
+    memcpy(attributes, parser->attributes, parser->attribute_count * sizeof(attribute_t));
+    element->attributes = attributes;
+    element->attribute_count = parser->attribute_count;
+    parser->attribute_count = 0;
 }
 
 #define IS_CSS_STARTNAMECHAR(c) (IS_ALPHA(c) || c == '_')
 #define IS_CSS_NAMECHAR(c) (IS_CSS_STARTNAMECHAR(c) || IS_NUM(c) || c == '-')
 
-static void parse_style(const char* data, int length, element_t* element, plutosvg_document_t* document)
+static void parse_style(plutosvg_parser_t* parser, const char* data, size_t length, element_t* element)
 {
     const char* it = data;
     const char* end = it + length;
@@ -1208,13 +2193,14 @@ static void parse_style(const char* data, int length, element_t* element, plutos
             ++it;
         length = rtrim(data, it) - data;
         if(id && element)
-            add_attribute(element, document, id, data, length);
+            parser_add_attribute(parser, element, id, data, length);
         skip_ws_delim(&it, end, ';');
     }
 }
 
-static bool parse_attributes(const char** begin, const char* end, element_t* element, plutosvg_document_t* document)
+static bool parse_attributes(plutosvg_parser_t* parser, const char** begin, const char* end, element_t* element)
 {
+    plutosvg_document_t* document = parser->document;
     const char* it = *begin;
     while(it < end && IS_STARTNAMECHAR(*it)) {
         const char* data = it++;
@@ -1231,20 +2217,23 @@ static bool parse_attributes(const char** begin, const char* end, element_t* ele
         const char quote = *it++;
         skip_ws(&it, end);
         data = it;
-        while(it < end && *it != quote)
-            ++it;
-        if(it >= end || *it != quote)
+        it = find_delim(it, end, quote);
+        if(it >= end)
             return false;
-        int length = rtrim(data, it) - data;
+        size_t length = rtrim(data, it) - data;
         if(id && element) {
+            data = parser_retain(parser, data, length);
             if(id == ATTR_ID) {
-                if(document->id_cache == NULL)
-                    document->id_cache = hashmap_create();
-                hashmap_put(document->id_cache, document->heap, data, length, element);
+                if(parser->materializing == NULL
+                    || is_subtree_owner(document, parser->materializing, id_index_get(&document->id_index, data, length))) {
+                    id_index_put(&document->id_index, data, length, element);
+                }
+            } else if(parser->skipping) {
+                /* parsed when the subtree is materialized */
             } else if(id == ATTR_STYLE) {
-                parse_style(data, length, element, document);
+                parse_style(parser, data, length, element);
             } else {
-                add_attribute(element, document, id, data, length);
+                parser_add_attribute(parser, element, id, data, length);
             }
         }
 
@@ -1252,277 +2241,2412 @@ static bool parse_attributes(const char** begin, const char* end, element_t* ele
         skip_ws(&it, end);
     }
 
+    parser_commit_attributes(parser, element);
     *begin = it;
     return true;
 }
 
-plutosvg_document_t* plutosvg_document_load_from_data(const char* data, int length, float width, float height, plutovg_destroy_func_t destroy_func, void* closure)
+static bool parse_markup(plutosvg_parser_t* parser, const char* begin, const char* end)
 {
-    if(length == -1)
-        length = strlen(data);
-    if(length >= 3) {
-        const uint8_t* buffer = (const uint8_t*)(data);
-
-        const uint8_t c1 = buffer[0];
-        const uint8_t c2 = buffer[1];
-        const uint8_t c3 = buffer[2];
-        if(c1 == 0xEF && c2 == 0xBB && c3 == 0xBF) {
-            data += 3;
-            length -= 3;
-        }
+    plutosvg_document_t* document = parser->document;
+    const char* it = begin + 1;
+    if(it < end && *it == '?') {
+        ++it;
+        if(!skip_string(&it, end, "xml"))
+            return false;
+        skip_ws(&it, end);
+        if(!parse_attributes(parser, &it, end, NULL))
+            return false;
+        if(!skip_string(&it, end, "?>"))
+            return false;
+        return it == end;
     }
 
-    const char* it = data;
-    const char* end = it + length;
+    if(it < end && *it == '!') {
+        /* comments, CDATA sections and DOCTYPE declarations were already delimited by find_markup_end */
+        return true;
+    }
 
-    plutosvg_document_t* document = plutosvg_document_create(width, height, destroy_func, closure);
-    element_t* current = NULL;
-    int ignoring = 0;
-    while(it < end) {
-        if(current == NULL) {
-            while(it < end && IS_WS(*it))
-                ++it;
-            if(it >= end) {
-                break;
+    if(it < end && *it == '/') {
+        if(parser->current == NULL && parser->ignoring == 0)
+            return false;
+        ++it;
+        if(it >= end || !IS_STARTNAMECHAR(*it))
+            return false;
+        const char* name = it++;
+        while(it < end && IS_NAMECHAR(*it))
+            ++it;
+        if(parser->ignoring > 0) {
+            --parser->ignoring;
+        } else if(parser->skipping) {
+            int id = elementid(name, it - name);
+            if(id != parser->skip_stack[--parser->skip_depth])
+                return false;
+            if(parser->skip_depth == 0) {
+                ((subtree_t*)(parser->skipping->subtree))->content_end = begin;
+                parser->skipping = NULL;
             }
         } else {
-            while(it < end && *it != '<') {
-                ++it;
+            int id = elementid(name, it - name);
+            if(id != parser->current->id)
+                return false;
+            parser->current = element_parent(parser->current);
+        }
+
+        skip_ws(&it, end);
+        if(it >= end || *it != '>')
+            return false;
+        ++it;
+        return it == end;
+    }
+
+    if(it >= end || !IS_STARTNAMECHAR(*it))
+        return false;
+    const char* name = it++;
+    while(it < end && IS_NAMECHAR(*it))
+        ++it;
+    element_t* element = NULL;
+    subtree_t* subtree = NULL;
+    if(parser->ignoring > 0) {
+        ++parser->ignoring;
+    } else {
+        int id = elementid(name, it - name);
+        if(id == TAG_UNKNOWN) {
+            parser->ignoring = 1;
+        } else if(parser->skipping) {
+            parser_push_skip(parser, id);
+            element = parser->skipping;
+        } else {
+            if(document->root_element && parser->current == NULL)
+                return false;
+            if(document->root_element == NULL && id != TAG_SVG)
+                return false;
+            if((element = parser_create_element(parser, id)) == NULL)
+                return false;
+            if((parser->flags & PLUTOSVG_LOAD_FLAGS_LAZY) && parser->current && parser->current == document->root_element) {
+                subtree = arena_alloc(document->arena, sizeof(subtree_t));
+                element->subtree = subtree;
+                parser->skipping = element;
+                parser_push_skip(parser, id);
             }
         }
+    }
 
-        if(it >= end || *it != '<')
-            goto error;
+    skip_ws(&it, end);
+    const char* attributes_begin = it;
+    if(!parse_attributes(parser, &it, end, parser->splitting && parser->skipping ? NULL : element))
+        return false;
+    if(subtree) {
+        subtree->attributes_begin = attributes_begin;
+        subtree->attributes_end = it;
+        subtree->content_begin = end;
+        subtree->content_end = end;
+    }
+
+    if(it < end && *it == '>') {
+        if(element && parser->skipping == NULL)
+            parser->current = element;
         ++it;
-        if(it < end && *it == '?') {
-            ++it;
-            if(!skip_string(&it, end, "xml"))
-                goto error;
-            skip_ws(&it, end);
-            if(!parse_attributes(&it, end, NULL, NULL))
-                goto error;
-            if(!skip_string(&it, end, "?>"))
-                goto error;
-            skip_ws(&it, end);
-            continue;
+        return it == end;
+    }
+
+    if(it < end && *it == '/') {
+        ++it;
+        if(it >= end || *it != '>')
+            return false;
+        if(parser->ignoring > 0) {
+            --parser->ignoring;
+        } else if(parser->skipping && --parser->skip_depth == 0) {
+            parser->skipping = NULL;
         }
 
-        if(it < end && *it == '!') {
-            ++it;
-            if(skip_string(&it, end, "--")) {
-                const char* begin = string_find(it, end, "-->");
-                if(begin == NULL)
-                    goto error;
-                it = begin + 3;
-                skip_ws(&it, end);
-                continue;
-            }
+        ++it;
+        return it == end;
+    }
 
-            if(skip_string(&it, end, "[CDATA[")) {
-                const char* begin = string_find(it, end, "]]>");
-                if(begin == NULL)
-                    goto error;
-                it = begin + 3;
-                skip_ws(&it, end);
-                continue;
-            }
+    return false;
+}
 
-            if(skip_string(&it, end, "DOCTYPE")) {
-                while(it < end && *it != '>') {
-                    if(*it == '[') {
-                        ++it;
-                        int depth = 1;
-                        while(it < end && depth > 0) {
-                            if(*it == '[') ++depth;
-                            else if(*it == ']') --depth;
-                            ++it;
-                        }
-                    } else {
-                        ++it;
-                    }
-                }
+static bool is_markup_prefix(const char* begin, const char* end, const char* data)
+{
+    while(begin < end && *data) {
+        if(*begin != *data)
+            return false;
+        ++begin;
+        ++data;
+    }
 
-                if(!skip_delim(&it, end, '>'))
-                    goto error;
-                skip_ws(&it, end);
-                continue;
-            }
+    return true;
+}
 
-            goto error;
+/*
+ * Locates the end of the markup that starts at `begin` ('<'). Returns false on malformed markup.
+ * Otherwise `*markup_end` is set past the closing '>', or to NULL when more data is needed; in that
+ * case the scan position is saved in the parser so the search resumes where it left off.
+ */
+static bool find_markup_end(plutosvg_parser_t* parser, const char* begin, const char* end, const char** markup_end)
+{
+    const char* it = begin + parser->scan_offset;
+    *markup_end = NULL;
+    if(parser->scan_offset == 0) {
+        if(end - begin < 2)
+            return true;
+        if(begin[1] != '!') {
+            it = begin + 1;
+        } else if(is_markup_prefix(begin + 2, end, "--")) {
+            if(end - begin < 4)
+                return true;
+            it = begin + 4;
+            parser->scan_depth = -1;
+        } else if(is_markup_prefix(begin + 2, end, "[CDATA[")) {
+            if(end - begin < 9)
+                return true;
+            it = begin + 9;
+            parser->scan_depth = -2;
+        } else if(is_markup_prefix(begin + 2, end, "DOCTYPE")) {
+            if(end - begin < 9)
+                return true;
+            it = begin + 9;
+        } else {
+            return false;
         }
+    }
 
-        if(it < end && *it == '/') {
-            if(current == NULL && ignoring == 0)
-                goto error;
-            ++it;
-            if(it >= end || !IS_STARTNAMECHAR(*it))
-                goto error;
-            const char* begin = it++;
-            while(it < end && IS_NAMECHAR(*it))
-                ++it;
-            if(ignoring == 0) {
-                int id = elementid(begin, it - begin);
-                if(id != current->id)
-                    goto error;
-                current = current->parent;
-            } else {
-                --ignoring;
+    if(parser->scan_depth < 0) {
+        const char* found = string_find(it, end, parser->scan_depth == -1 ? "-->" : "]]>");
+        if(found) {
+            *markup_end = found + 3;
+        } else if(end - it > 2) {
+            it = end - 2;
+        }
+    } else if(begin[1] == '!') {
+        while(it < end) {
+            if(parser->scan_depth > 0) {
+                if(*it == '[') {
+                    ++parser->scan_depth;
+                } else if(*it == ']') {
+                    --parser->scan_depth;
+                }
+            } else if(*it == '[') {
+                parser->scan_depth = 1;
+            } else if(*it == '>') {
+                *markup_end = it + 1;
+                break;
             }
 
-            skip_ws(&it, end);
-            if(it >= end || *it != '>')
-                goto error;
             ++it;
-            continue;
         }
+    } else {
+        while(it < end) {
+            if(parser->scan_quote) {
+                it = find_delim(it, end, parser->scan_quote);
+                if(it == end)
+                    break;
+                parser->scan_quote = 0;
+            } else if(*it == '"' || *it == '\'') {
+                parser->scan_quote = *it;
+            } else if(*it == '>') {
+                *markup_end = it + 1;
+                break;
+            }
 
-        if(it >= end || !IS_STARTNAMECHAR(*it))
-            goto error;
-        const char* begin = it++;
-        while(it < end && IS_NAMECHAR(*it))
             ++it;
-        element_t* element = NULL;
-        if(ignoring > 0) {
-            ++ignoring;
-        } else {
-            int id = elementid(begin, it - begin);
-            if(id == TAG_UNKNOWN) {
-                ignoring = 1;
+        }
+    }
+
+    if(*markup_end) {
+        parser->scan_offset = 0;
+        parser->scan_quote = 0;
+        parser->scan_depth = 0;
+    } else {
+        parser->scan_offset = it - begin;
+    }
+
+    return true;
+}
+
+static bool parser_parse(plutosvg_parser_t* parser, const char** begin, const char* end, bool final)
+{
+    const char* it = *begin;
+    if(!parser->started) {
+        if(end - it < 3 && !final)
+            return true;
+        if(end - it >= 3) {
+            const uint8_t* buffer = (const uint8_t*)(it);
+
+            const uint8_t c1 = buffer[0];
+            const uint8_t c2 = buffer[1];
+            const uint8_t c3 = buffer[2];
+            if(c1 == 0xEF && c2 == 0xBB && c3 == 0xBF) {
+                it += 3;
+            }
+        }
+
+        parser->started = true;
+    }
+
+    while(it < end) {
+        if(parser->scan_offset == 0) {
+            if(parser->current == NULL) {
+                while(it < end && IS_WS(*it))
+                    ++it;
+                if(it >= end) {
+                    break;
+                }
+
+                if(*it != '<') {
+                    return false;
+                }
             } else {
-                if(document->root_element && current == NULL)
-                    goto error;
-                element = heap_alloc(document->heap, sizeof(element_t));
-                element->id = id;
-                element->parent = NULL;
-                element->next_sibling = NULL;
-                element->first_child = NULL;
-                element->last_child = NULL;
-                element->attributes = NULL;
-                if(document->root_element == NULL) {
-                    if(element->id != TAG_SVG)
-                        goto error;
-                    document->root_element = element;
-                } else {
-                    element->parent = current;
-                    if(current->last_child) {
-                        current->last_child->next_sibling = element;
-                        current->last_child = element;
-                    } else {
-                        current->last_child = element;
-                        current->first_child = element;
-                    }
+                it = find_delim(it, end, '<');
+                if(it >= end) {
+                    break;
                 }
             }
         }
 
-        skip_ws(&it, end);
-        if(!parse_attributes(&it, end, element, document))
+        const char* markup_end;
+        if(!find_markup_end(parser, it, end, &markup_end))
+            return false;
+        if(markup_end == NULL) {
+            if(final)
+                return false;
+            break;
+        }
+
+        if(!parse_markup(parser, it, markup_end))
+            return false;
+        it = markup_end;
+        if(parser->probing && parser->document->root_element) {
+            break;
+        }
+    }
+
+    *begin = it;
+    return true;
+}
+
+static bool compile_number(const element_t* element, int id, property_t* property, bool percent)
+{
+    float number;
+    if(!parse_number(element, id, &number, percent, false))
+        return false;
+    memcpy(property, &number, sizeof(number));
+    return true;
+}
+
+static bool compile_length(const element_t* element, int id, property_t* property, bool negative)
+{
+    length_t length;
+    if(!parse_length(element, id, &length, negative, false))
+        return false;
+    memcpy(property, &length, sizeof(length));
+    return true;
+}
+
+#define COMPILE_ENUM(type, parse, element, id, property) \
+    do { \
+        type value = (type)(-1); \
+        if(!parse(element, id, &value) || value == (type)(-1)) \
+            return false; \
+        memcpy(property, &value, sizeof(value)); \
+        return true; \
+    } while(0)
+
+static bool compile_property(plutosvg_document_t* document, const element_t* element, int id, property_t* property)
+{
+    switch(id) {
+    case ATTR_OFFSET:
+    case ATTR_OPACITY:
+    case ATTR_FILL_OPACITY:
+    case ATTR_STOP_OPACITY:
+    case ATTR_STROKE_OPACITY:
+        return compile_number(element, id, property, true);
+    case ATTR_STROKE_MITERLIMIT:
+        return compile_number(element, id, property, false);
+    case ATTR_X:
+    case ATTR_Y:
+    case ATTR_X1:
+    case ATTR_Y1:
+    case ATTR_X2:
+    case ATTR_Y2:
+    case ATTR_CX:
+    case ATTR_CY:
+    case ATTR_FX:
+    case ATTR_FY:
+        return compile_length(element, id, property, true);
+    case ATTR_R:
+    case ATTR_RX:
+    case ATTR_RY:
+    case ATTR_WIDTH:
+    case ATTR_HEIGHT:
+    case ATTR_STROKE_WIDTH:
+    case ATTR_STROKE_DASHOFFSET:
+        return compile_length(element, id, property, false);
+    case ATTR_COLOR:
+    case ATTR_STOP_COLOR: {
+        color_t color;
+        if(!parse_color(element, id, &color, false))
+            return false;
+        memcpy(property, &color, sizeof(color));
+        return true;
+    }
+
+    case ATTR_FILL:
+    case ATTR_STROKE: {
+        paint_t fill = {paint_type_color, {color_type_fixed, 0xFF000000}, {NULL, 0}};
+        paint_t stroke = {paint_type_none, {color_type_fixed, 0}, {NULL, 0}};
+        paint_t* paint = (id == ATTR_FILL) ? &fill : &stroke;
+        if(!parse_paint(element, id, paint))
+            return false;
+        memcpy(property, paint, sizeof(paint_t));
+        return true;
+    }
+
+    case ATTR_TRANSFORM:
+    case ATTR_GRADIENT_TRANSFORM: {
+        plutovg_matrix_t matrix = PLUTOVG_IDENTITY_MATRIX;
+        plutovg_matrix_t check = {2, 0, 0, 2, 1, 1};
+        if(!parse_transform(element, id, &matrix) || !parse_transform(element, id, &check))
+            return false;
+        if(memcmp(&matrix, &check, sizeof(matrix)))
+            return false;
+        memcpy(property, &matrix, sizeof(matrix));
+        return true;
+    }
+
+    case ATTR_VIEW_BOX: {
+        plutovg_rect_t view_box;
+        if(!parse_view_box(element, id, &view_box))
+            return false;
+        memcpy(property, &view_box, sizeof(view_box));
+        return true;
+    }
+
+    case ATTR_PRESERVE_ASPECT_RATIO: {
+        view_position_t position;
+        if(!parse_view_position(element, id, &position))
+            return false;
+        memcpy(property, &position, sizeof(position));
+        return true;
+    }
+
+    case ATTR_STROKE_DASHARRAY: {
+        stroke_dash_array_t dash_array = {0};
+        if(!parse_dash_array(element, id, &dash_array))
+            return false;
+        compiled_dash_array_t compiled = {NULL, dash_array.size};
+        if(dash_array.size > 0) {
+            length_t* data = arena_alloc(document->arena, dash_array.size * sizeof(length_t));
+            memcpy(data, dash_array.data, dash_array.size * sizeof(length_t));
+            compiled.data = data;
+        }
+
+        memcpy(property, &compiled, sizeof(compiled));
+        return true;
+    }
+
+    case ATTR_STROKE_LINECAP:
+        COMPILE_ENUM(plutovg_line_cap_t, parse_line_cap, element, id, property);
+    case ATTR_STROKE_LINEJOIN:
+        COMPILE_ENUM(plutovg_line_join_t, parse_line_join, element, id, property);
+    case ATTR_FILL_RULE:
+        COMPILE_ENUM(plutovg_fill_rule_t, parse_fill_rule, element, id, property);
+    case ATTR_SPREAD_METHOD:
+        COMPILE_ENUM(plutovg_spread_method_t, parse_spread_method, element, id, property);
+    case ATTR_GRADIENT_UNITS:
+        COMPILE_ENUM(units_type_t, parse_units_type, element, id, property);
+    case ATTR_DISPLAY:
+        COMPILE_ENUM(display_t, parse_display, element, id, property);
+    case ATTR_VISIBILITY:
+        COMPILE_ENUM(visibility_t, parse_visibility, element, id, property);
+    default:
+        return false;
+    }
+}
+
+static void compile_element(plutosvg_document_t* document, element_t* element)
+{
+    property_t properties[64];
+    uint64_t property_mask = 0;
+    int count = 0;
+
+    uint64_t mask = element->attribute_mask & ~element->inherit_mask;
+    while(mask) {
+        const uint64_t bit = mask & (~mask + 1);
+        mask &= mask - 1;
+        if(compile_property(document, element, popcount(bit - 1), properties + count)) {
+            property_mask |= bit;
+            count += 1;
+        }
+    }
+
+    if(count > 0) {
+        property_t* data = arena_alloc(document->arena, count * sizeof(property_t));
+        memcpy(data, properties, count * sizeof(property_t));
+        element->properties = data;
+        element->property_mask = property_mask;
+    }
+}
+
+static void compile_subtree(plutosvg_document_t* document, element_t* root, int flags)
+{
+    element_t* element = root;
+    while(element) {
+        if(element->subtree == NULL) {
+            if(flags & PLUTOSVG_LOAD_FLAGS_COMPILE)
+                compile_element(document, element);
+            if(flags & PLUTOSVG_LOAD_FLAGS_BUILD_PATHS) {
+                if(element->id == TAG_PATH || element->id == TAG_POLYLINE || element->id == TAG_POLYGON) {
+                    resolve_shape(document, element);
+                }
+            }
+
+            if(element->first_child) {
+                element = element_first_child(element);
+                continue;
+            }
+        }
+
+        while(element != root && element->next_sibling == 0)
+            element = element_parent(element);
+        element = element == root ? NULL : element_next_sibling(element);
+    }
+}
+
+/*
+ * Computes the style of every element of a subtree whose root's parent already has its style.
+ */
+static void compute_styles(plutosvg_document_t* document, element_t* root)
+{
+    element_t* element = root;
+    while(element) {
+        const style_t* base = element->parent ? element_parent(element)->style : NULL;
+        if(style_mask(element) == 0) {
+            element->style = base;
+        } else {
+            element->style = inherit_style(arena_alloc(document->arena, sizeof(style_t)), base, element);
+        }
+
+        if(element->first_child) {
+            element = element_first_child(element);
+            continue;
+        }
+
+        while(element != root && element->next_sibling == 0)
+            element = element_parent(element);
+        element = element == root ? NULL : element_next_sibling(element);
+    }
+}
+
+static void compile_document(plutosvg_document_t* document, int flags)
+{
+    compile_subtree(document, document->root_element, flags);
+}
+
+/*
+ * Copies every string the document keeps into one block of its arena, so the source can be released.
+ */
+static void own_strings(plutosvg_document_t* document)
+{
+    size_t size = 0;
+    for(size_t i = 0; i < document->element_count; ++i) {
+        const element_t* element = document->elements + i;
+        for(uint32_t j = 0; j < element->attribute_count; ++j) {
+            size += element->attributes[j].value.length;
+        }
+    }
+
+    for(size_t i = 0; i < document->id_index.capacity; ++i) {
+        if(document->id_index.slots[i].element) {
+            size += document->id_index.slots[i].length;
+        }
+    }
+
+    if(size == 0)
+        return;
+    char* data = arena_alloc(document->arena, size);
+    for(size_t i = 0; i < document->element_count; ++i) {
+        const element_t* element = document->elements + i;
+        for(uint32_t j = 0; j < element->attribute_count; ++j) {
+            string_t* value = (string_t*)(&element->attributes[j].value);
+            memcpy(data, value->data, value->length);
+            value->data = data;
+            data += value->length;
+        }
+    }
+
+    for(size_t i = 0; i < document->id_index.capacity; ++i) {
+        id_slot_t* slot = document->id_index.slots + i;
+        if(slot->element == NULL)
+            continue;
+        memcpy(data, slot->data, slot->length);
+        slot->data = data;
+        data += slot->length;
+    }
+}
+
+enum {
+    PRUNE_KEPT = 1 << 0,
+    PRUNE_IN_PLACE = 1 << 1,
+    PRUNE_WHOLE = 1 << 2,
+    PRUNE_REFERENCED = 1 << 3,
+    PRUNE_CONTAINS = 1 << 4
+};
+
+static void prune_mark(const plutosvg_document_t* document, uint8_t* states, const element_t* target)
+{
+    if(target == NULL)
+        return;
+    states[target - document->elements] |= PRUNE_REFERENCED;
+    while(target && !(states[target - document->elements] & PRUNE_CONTAINS)) {
+        states[target - document->elements] |= PRUNE_CONTAINS;
+        target = element_parent(target);
+    }
+}
+
+static bool is_element_drawable(const plutosvg_document_t* document, const element_t* element)
+{
+    display_t display = display_inline;
+    parse_display(element, ATTR_DISPLAY, &display);
+    if(display == display_none)
+        return false;
+    length_t a = {0, length_type_fixed};
+    length_t b = {0, length_type_fixed};
+    switch(element->id) {
+    case TAG_SVG:
+    case TAG_G:
+    case TAG_LINE:
+    case TAG_PATH:
+    case TAG_POLYLINE:
+    case TAG_POLYGON:
+        return true;
+    case TAG_USE: {
+        const string_t* value = find_attribute(element, ATTR_HREF, false);
+        return value && value->length > 1 && value->data[0] == '#'
+            && id_index_get(&document->id_index, value->data + 1, value->length - 1);
+    }
+
+    case TAG_CIRCLE:
+        parse_length(element, ATTR_R, &a, false, false);
+        return !is_length_zero(a);
+    case TAG_ELLIPSE:
+        parse_length(element, ATTR_RX, &a, false, false);
+        parse_length(element, ATTR_RY, &b, false, false);
+        return !is_length_zero(a) && !is_length_zero(b);
+    case TAG_RECT:
+    case TAG_IMAGE:
+        parse_length(element, ATTR_WIDTH, &a, false, false);
+        parse_length(element, ATTR_HEIGHT, &b, false, false);
+        return !is_length_zero(a) && !is_length_zero(b);
+    default:
+        return false;
+    }
+}
+
+/*
+ * Removes the elements that can never contribute to a render: hidden or degenerate subtrees of the drawn
+ * tree, and anything outside it that no href or paint url refers to. Referenced elements keep their whole
+ * subtree. The element array stays in document order and the id index is rebuilt without the removed
+ * elements. Must run before any other element pointer is taken; leaves the document untouched when memory
+ * runs out.
+ */
+static void prune_document(plutosvg_document_t* document)
+{
+    const size_t count = document->element_count;
+    uint8_t* states = calloc(MAX(count, 1), sizeof(uint8_t));
+    int32_t* indices = malloc(MAX(count, 1) * sizeof(int32_t));
+    id_index_t index;
+    id_index_init(&index);
+    if(states == NULL || indices == NULL)
+        goto cleanup;
+    for(size_t i = 0; i < count; ++i) {
+        const element_t* element = document->elements + i;
+        if(element->attribute_mask & ATTRIBUTE_BIT(ATTR_HREF)) {
+            const string_t* value = find_attribute(element, ATTR_HREF, false);
+            if(value && value->length > 1 && value->data[0] == '#') {
+                prune_mark(document, states, id_index_get(&document->id_index, value->data + 1, value->length - 1));
+            }
+        }
+
+        static const int paints[] = {ATTR_FILL, ATTR_STROKE};
+        for(int j = 0; j < 2; ++j) {
+            paint_t paint;
+            if((element->attribute_mask & ATTRIBUTE_BIT(paints[j]))
+                && parse_paint(element, paints[j], &paint) && paint.type == paint_type_url) {
+                prune_mark(document, states, id_index_get(&document->id_index, paint.id.data, paint.id.length));
+            }
+        }
+    }
+
+    size_t kept = 0;
+    for(size_t i = 0; i < count; ++i) {
+        const element_t* element = document->elements + i;
+        const element_t* parent = element_parent(element);
+        uint8_t state = states[i];
+        if(parent == NULL) {
+            state |= PRUNE_KEPT | PRUNE_IN_PLACE;
+        } else {
+            const uint8_t parent_state = states[parent - document->elements];
+            if(!(parent_state & PRUNE_KEPT)) {
+                state = 0;
+            } else if(parent_state & PRUNE_WHOLE) {
+                state |= PRUNE_KEPT | PRUNE_WHOLE;
+            } else if(state & PRUNE_REFERENCED) {
+                state |= PRUNE_KEPT | PRUNE_WHOLE;
+            } else {
+                if((parent_state & PRUNE_IN_PLACE) && (parent->id == TAG_SVG || parent->id == TAG_G)
+                    && is_element_drawable(document, element)) {
+                    state |= PRUNE_KEPT | PRUNE_IN_PLACE;
+                }
+
+                if(state & PRUNE_CONTAINS) {
+                    state |= PRUNE_KEPT;
+                }
+            }
+        }
+
+        states[i] = state;
+        indices[i] = (state & PRUNE_KEPT) ? (int32_t)(kept++) : -1;
+    }
+
+    if(kept == count || !id_index_reserve(&index, document->id_index.size))
+        goto cleanup;
+    for(size_t i = 0; i < document->id_index.capacity; ++i) {
+        const id_slot_t* slot = document->id_index.slots + i;
+        if(slot->element && indices[slot->element - document->elements] != -1) {
+            id_index_put(&index, slot->data, slot->length, document->elements + indices[slot->element - document->elements]);
+        }
+    }
+
+    for(size_t i = 0; i < count; ++i) {
+        element_t element = document->elements[i];
+        if(indices[i] == -1) {
+            if(element.shape)
+                plutovg_path_destroy(element.shape->path);
+            continue;
+        }
+
+        element_t* parent = element.parent ? document->elements + indices[i + element.parent] : NULL;
+        element_t* target = document->elements + indices[i];
+        *target = element;
+        target->parent = parent ? (int32_t)(parent - target) : 0;
+        target->next_sibling = 0;
+        target->first_child = 0;
+        target->last_child = 0;
+        if(parent == NULL)
+            continue;
+        if(parent->last_child) {
+            element_t* last_child = element_link(parent, parent->last_child);
+            last_child->next_sibling = (int32_t)(target - last_child);
+        } else {
+            parent->first_child = (int32_t)(target - parent);
+        }
+
+        parent->last_child = (int32_t)(target - parent);
+    }
+
+    free(document->id_index.slots);
+    document->id_index = index;
+    document->element_count = kept;
+    document->pruned_count = count - kept;
+    index.slots = NULL;
+cleanup:
+    free(index.slots);
+    free(states);
+    free(indices);
+}
+
+/*
+ * Applies the intrinsic sizing rules to the root element: explicit width and height first, then the
+ * viewBox ratio, then the 300x150 default.
+ */
+static bool resolve_intrinsic_size(const element_t* root, float width, float height, float* intrinsic_width, float* intrinsic_height)
+{
+    length_t w = {100, length_type_percent};
+    length_t h = {100, length_type_percent};
+
+    parse_length(root, ATTR_WIDTH, &w, false, false);
+    parse_length(root, ATTR_HEIGHT, &h, false, false);
+
+    float _w = convert_length(&w, width);
+    float _h = convert_length(&h, height);
+    if(_w <= 0.f || _h <= 0.f) {
+        plutovg_rect_t view_box = {0, 0, 0, 0};
+        if(parse_view_box(root, ATTR_VIEW_BOX, &view_box)) {
+            float intrinsic_ratio = view_box.w / view_box.h;
+            if(_w <= 0.f && _h > 0.f) {
+                _w = _h * intrinsic_ratio;
+            } else if(_w > 0.f && _h <= 0.f) {
+                _h = _w / intrinsic_ratio;
+            } else {
+                _w = view_box.w;
+                _h = view_box.h;
+            }
+        } else {
+            if(_w == -1)
+                _w = 300;
+            if(_h == -1) {
+                _h = 150;
+            }
+        }
+    }
+
+    if(_w <= 0.f || _h <= 0.f)
+        return false;
+    *intrinsic_width = _w;
+    *intrinsic_height = _h;
+    return true;
+}
+
+static plutosvg_document_t* finish_document(plutosvg_document_t* document, int flags)
+{
+    if(document->root_element) {
+        if(!resolve_intrinsic_size(document->root_element, document->width, document->height, &document->width, &document->height))
+            goto error;
+        if(flags & PLUTOSVG_LOAD_FLAGS_PRUNE)
+            prune_document(document);
+        if(!(flags & PLUTOSVG_LOAD_FLAGS_LAZY) && document->element_count < document->element_capacity)
+            resize_elements(document, document->element_count);
+        if(flags & PLUTOSVG_LOAD_FLAGS_OWN_DATA)
+            own_strings(document);
+        if(flags & (PLUTOSVG_LOAD_FLAGS_COMPILE | PLUTOSVG_LOAD_FLAGS_BUILD_PATHS))
+            compile_document(document, flags);
+        if((document->bounds_slots = calloc(document->element_capacity, sizeof(bounds_slot_t))) == NULL)
+            goto error;
+        compute_styles(document, document->root_element);
+        if(flags & PLUTOSVG_LOAD_FLAGS_LAZY) {
+            for(const element_t* child = element_first_child(document->root_element); child; child = element_next_sibling(child)) {
+                if(child->subtree) {
+                    document->pending_subtrees += 1;
+                }
+            }
+        }
+
+        if((flags & PLUTOSVG_LOAD_FLAGS_OWN_DATA) && document->destroy_func) {
+            document->destroy_func(document->closure);
+            document->destroy_func = NULL;
+        }
+
+        return document;
+    }
+
+error:
+    plutosvg_document_destroy(document);
+    return NULL;
+}
+
+static plutosvg_document_t* parser_finish(plutosvg_parser_t* parser)
+{
+    if(parser->ignoring == 0 && parser->current == NULL)
+        return finish_document(parser->document, parser->flags);
+    plutosvg_document_destroy(parser->document);
+    return NULL;
+}
+
+/*
+ * Marks a subtree whose source failed to parse when it was materialized. Its owner keeps no children, ids
+ * found in the subtree resolve to the owner again, and the owner is then treated as invalid: it is never
+ * rendered, measured or returned by id, just as an eager load would have rejected the source.
+ */
+static const subtree_t failed_subtree;
+
+static void fail_subtree(plutosvg_document_t* document, element_t* owner, size_t first_element)
+{
+    const element_t* first = document->elements + first_element;
+    for(size_t i = 0; i < document->id_index.capacity; ++i) {
+        id_slot_t* slot = document->id_index.slots + i;
+        if(slot->element && slot->element >= first) {
+            slot->element = owner;
+        }
+    }
+
+    owner->first_child = 0;
+    owner->last_child = 0;
+    owner->subtree = &failed_subtree;
+}
+
+static bool materialize_element(const plutosvg_document_t* document, const element_t* element)
+{
+    const subtree_t* subtree = element->subtree;
+    if(subtree == NULL)
+        return true;
+    if(subtree == &failed_subtree)
+        return false;
+    element_t* owner = (element_t*)(element);
+    owner->subtree = NULL;
+    const size_t first_element = document->element_count;
+
+    plutosvg_parser_t parser;
+    parser_init(&parser, (plutosvg_document_t*)(document), document->flags & ~PLUTOSVG_LOAD_FLAGS_LAZY, false);
+    parser.current = owner;
+    parser.started = true;
+    parser.materializing = owner;
+
+    const char* it = subtree->attributes_begin;
+    bool success = parse_attributes(&parser, &it, subtree->attributes_end, owner);
+    if(success) {
+        it = subtree->content_begin;
+        success = parser_parse(&parser, &it, subtree->content_end, true);
+    }
+
+    plutosvg_document_t* mutable_document = (plutosvg_document_t*)(document);
+    if(success) {
+        if(document->flags & (PLUTOSVG_LOAD_FLAGS_COMPILE | PLUTOSVG_LOAD_FLAGS_BUILD_PATHS))
+            compile_subtree(mutable_document, owner, document->flags);
+        compute_styles(mutable_document, owner);
+    } else {
+        fail_subtree(mutable_document, owner, first_element);
+    }
+
+    atomic_store_int(&mutable_document->pending_subtrees, document->pending_subtrees - 1);
+    return success;
+}
+
+static bool materialize_document(const plutosvg_document_t* document)
+{
+    bool success = true;
+    for(const element_t* child = element_first_child(document->root_element); child; child = element_next_sibling(child)) {
+        if(!materialize_element(document, child)) {
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+/*
+ * Brackets a call that reads a shared document. Lazily loaded documents add elements while they are
+ * read, so such calls on them run one at a time until every subtree has been parsed; after that, and for
+ * other documents, no lock is taken here. Returns whether the lock was taken.
+ */
+static bool document_begin_read(const plutosvg_document_t* document)
+{
+    if(!(document->flags & PLUTOSVG_LOAD_FLAGS_LAZY) || atomic_load_int(&document->pending_subtrees) == 0)
+        return false;
+    mutex_lock(&document->materialize_lock);
+    return true;
+}
+
+static void document_end_read(const plutosvg_document_t* document, bool locked)
+{
+    if(locked) {
+        mutex_unlock(&document->materialize_lock);
+    }
+}
+
+/*
+ * Counts, in a single pass, the start tags in the source, an upper bound on the number of elements it can
+ * produce, and the "id" attributes of those tags, so the element array and the id index can be sized before
+ * parsing. Quoted attribute values are skipped with memchr rather than searched, so long data URIs stay cheap.
+ */
+static void count_source(const char* data, size_t length, size_t* element_count, size_t* id_count)
+{
+    size_t elements = 0;
+    size_t ids = 0;
+    const char* it = data;
+    const char* end = it + length;
+    while((it = memchr(it, '<', end - it)) != NULL) {
+        if(++it >= end || !IS_STARTNAMECHAR(*it))
+            continue;
+        ++elements;
+        while(it < end && IS_NAMECHAR(*it))
+            ++it;
+        while(true) {
+            skip_ws(&it, end);
+            if(it >= end || !IS_STARTNAMECHAR(*it))
+                break;
+            const char* name = it++;
+            while(it < end && IS_NAMECHAR(*it))
+                ++it;
+            if(it - name == 2 && name[0] == 'i' && name[1] == 'd')
+                ++ids;
+            skip_ws(&it, end);
+            if(it >= end || *it != '=')
+                break;
+            ++it;
+            skip_ws(&it, end);
+            if(it >= end || (*it != '"' && *it != '\''))
+                break;
+            const char* quote = memchr(it + 1, *it, end - it - 1);
+            it = quote ? quote + 1 : end;
+        }
+    }
+
+    *element_count = elements;
+    *id_count = ids;
+}
+
+#if defined(PLUTOSVG_HAS_THREADS)
+
+typedef void (*thread_func_t)(void* closure);
+
+typedef struct {
+    thread_func_t func;
+    void* closure;
+#if defined(_WIN32)
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+} thread_t;
+
+#if defined(_WIN32)
+
+static DWORD WINAPI thread_main(LPVOID data)
+{
+    thread_t* thread = data;
+    thread->func(thread->closure);
+    return 0;
+}
+
+static bool thread_start(thread_t* thread, thread_func_t func, void* closure)
+{
+    thread->func = func;
+    thread->closure = closure;
+    thread->handle = CreateThread(NULL, 0, thread_main, thread, 0, NULL);
+    return thread->handle != NULL;
+}
+
+static void thread_join(thread_t* thread)
+{
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+}
+
+static int thread_count(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return MAX(1, (int)(info.dwNumberOfProcessors));
+}
+
+#else
+
+static void* thread_main(void* data)
+{
+    thread_t* thread = data;
+    thread->func(thread->closure);
+    return NULL;
+}
+
+static bool thread_start(thread_t* thread, thread_func_t func, void* closure)
+{
+    thread->func = func;
+    thread->closure = closure;
+    return pthread_create(&thread->handle, NULL, thread_main, thread) == 0;
+}
+
+static void thread_join(thread_t* thread)
+{
+    pthread_join(thread->handle, NULL);
+}
+
+static int thread_count(void)
+{
+#if defined(_SC_NPROCESSORS_ONLN)
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)(MIN(count, 64)) : 1;
+#else
+    return 1;
+#endif
+}
+
+#endif
+
+/*
+ * Moves every block of `other` into `arena` and destroys `other`.
+ */
+static void arena_merge(plutosvg_arena_t* arena, plutosvg_arena_t* other)
+{
+    mutex_lock(&arena->lock);
+    arena_block_t* lists[] = {other->blocks, other->large_blocks, other->free_blocks};
+    for(int i = 0; i < 3; ++i) {
+        arena_block_t* block = lists[i];
+        while(block) {
+            arena_block_t* next = block->next;
+            block->next = arena->large_blocks;
+            arena->large_blocks = block;
+            block = next;
+        }
+    }
+
+    mutex_unlock(&arena->lock);
+    mutex_destroy(&other->lock);
+    free(other);
+}
+
+#define PARALLEL_MIN_TASK_SIZE (1 << 20)
+
+/*
+ * Builds a run of children of the root into a private document, under a placeholder root, from the
+ * ranges recorded by the splitting pass.
+ */
+typedef struct {
+    plutosvg_document_t* document;
+    const element_t* first;
+    size_t count;
+    int flags;
+    bool success;
+    bool threaded;
+    thread_t thread;
+} load_task_t;
+
+static void load_task_run(void* closure)
+{
+    load_task_t* task = closure;
+    plutosvg_document_t* document = task->document;
+    const element_t* last = task->first;
+    for(size_t i = 1; i < task->count; ++i)
+        last = element_next_sibling(last);
+    const char* begin = task->first->subtree->attributes_begin;
+    const char* end = last->subtree->content_end;
+    task->success = false;
+    size_t element_count, id_count;
+    count_source(begin, end - begin, &element_count, &id_count);
+    id_index_reserve(&document->id_index, id_count);
+    if(!resize_elements(document, 1 + element_count))
+        return;
+    plutosvg_parser_t parser;
+    parser_init(&parser, document, task->flags, false);
+    parser.started = true;
+    create_element(document, NULL, TAG_SVG);
+
+    const element_t* child = task->first;
+    for(size_t i = 0; i < task->count; ++i) {
+        const subtree_t* subtree = child->subtree;
+        parser.current = document->root_element;
+        element_t* element = parser_create_element(&parser, child->id);
+        if(element == NULL)
+            return;
+        const size_t index = element - document->elements;
+        const char* it = subtree->attributes_begin;
+        if(!parse_attributes(&parser, &it, subtree->attributes_end, element))
+            return;
+        parser.current = element;
+        it = subtree->content_begin;
+        if(!parser_parse(&parser, &it, subtree->content_end, true)
+            || parser.ignoring > 0 || parser.current != document->elements + index) {
+            return;
+        }
+
+        child = element_next_sibling(child);
+    }
+
+    task->success = true;
+}
+
+/*
+ * Parses a large document on several threads. A splitting pass parses the root start tag and delimits
+ * its children without reading their attributes; runs of children of similar source size are then
+ * parsed into private documents and stitched after the root in source order, which reproduces the
+ * element array and the id index of the serial parse. Returns false when the document should be parsed
+ * serially instead, with the parser untouched, or when it is malformed, with `*failed` set.
+ */
+static bool parser_parse_parallel(plutosvg_parser_t* parser, const char* data, size_t length, bool* failed)
+{
+    int count = (int)(MIN(length / PARALLEL_MIN_TASK_SIZE, 64));
+    if(count < 2 || (count = MIN(count, thread_count())) < 2)
+        return false;
+    plutosvg_document_t* document = parser->document;
+    const int flags = parser->flags;
+    parser->flags |= PLUTOSVG_LOAD_FLAGS_LAZY;
+    parser->splitting = true;
+
+    load_task_t* tasks = NULL;
+    element_t* elements = NULL;
+    id_index_t index;
+    id_index_init(&index);
+
+    *failed = true;
+    const char* it = data;
+    if(!parser_parse(parser, &it, data + length, true) || document->root_element == NULL)
+        goto cleanup;
+    const element_t* root = document->root_element;
+    if(root->first_child == 0) {
+        *failed = false;
+        goto cleanup;
+    }
+
+    const element_t* first = element_first_child(root);
+    const element_t* last = element_link(root, root->last_child);
+    const size_t size = last->subtree->content_end - first->subtree->attributes_begin;
+    tasks = calloc(count, sizeof(load_task_t));
+    if(tasks == NULL)
+        goto cleanup;
+    int task_count = 0;
+    for(const element_t* child = first; child; child = element_next_sibling(child)) {
+        load_task_t* task = tasks + task_count;
+        if(task->count > 0 && task_count + 1 < count
+            && (size_t)(child->subtree->attributes_begin - first->subtree->attributes_begin) >= size / count * (task_count + 1)) {
+            ++task;
+            ++task_count;
+        }
+
+        if(task->count++ == 0) {
+            task->first = child;
+            task->flags = flags;
+            task->document = plutosvg_document_create(document->width, document->height, NULL, 0, NULL, NULL);
+            if(task->document == NULL) {
+                goto cleanup;
+            }
+        }
+    }
+
+    ++task_count;
+    for(int i = 1; i < task_count; ++i) {
+        tasks[i].threaded = thread_start(&tasks[i].thread, load_task_run, tasks + i);
+    }
+
+    load_task_run(tasks);
+    for(int i = 1; i < task_count; ++i) {
+        if(tasks[i].threaded) {
+            thread_join(&tasks[i].thread);
+        } else {
+            load_task_run(tasks + i);
+        }
+    }
+
+    size_t total = 1;
+    size_t id_count = document->id_index.size;
+    for(int i = 0; i < task_count; ++i) {
+        if(!tasks[i].success)
+            goto cleanup;
+        total += tasks[i].document->element_count - 1;
+        id_count += tasks[i].document->id_index.size;
+    }
+
+    if(total > INT32_MAX || (elements = malloc(total * sizeof(element_t))) == NULL || !id_index_reserve(&index, id_count))
+        goto cleanup;
+    elements[0] = *root;
+    elements[0].first_child = 0;
+    elements[0].last_child = 0;
+    for(size_t i = 0; i < document->id_index.capacity; ++i) {
+        const id_slot_t* slot = document->id_index.slots + i;
+        if(slot->element == root) {
+            id_index_put(&index, slot->data, slot->length, elements);
+        }
+    }
+
+    size_t offset = 1;
+    size_t previous = 0;
+    for(int i = 0; i < task_count; ++i) {
+        plutosvg_document_t* fragment = tasks[i].document;
+        memcpy(elements + offset, fragment->elements + 1, (fragment->element_count - 1) * sizeof(element_t));
+        for(const element_t* child = element_first_child(fragment->root_element); child; child = element_next_sibling(child)) {
+            const size_t position = offset + (child - fragment->elements - 1);
+            elements[position].parent = -(int32_t)(position);
+            if(previous) {
+                elements[previous].next_sibling = (int32_t)(position - previous);
+            } else {
+                elements[0].first_child = (int32_t)(position);
+            }
+
+            elements[0].last_child = (int32_t)(position);
+            previous = position;
+        }
+
+        for(size_t j = 0; j < fragment->id_index.capacity; ++j) {
+            const id_slot_t* slot = fragment->id_index.slots + j;
+            if(slot->element) {
+                id_index_put(&index, slot->data, slot->length, elements + offset + (slot->element - fragment->elements - 1));
+            }
+        }
+
+        offset += fragment->element_count - 1;
+    }
+
+    for(int i = 0; i < task_count; ++i) {
+        arena_merge(document->arena, tasks[i].document->arena);
+        tasks[i].document->owns_arena = false;
+    }
+
+    free(document->elements);
+    free(document->id_index.slots);
+    document->elements = elements;
+    document->element_count = total;
+    document->element_capacity = total;
+    document->root_element = elements;
+    document->id_index = index;
+    elements = NULL;
+    index.slots = NULL;
+    *failed = false;
+cleanup:
+    if(tasks) {
+        for(int i = 0; i < count; ++i) {
+            plutosvg_document_destroy(tasks[i].document);
+        }
+    }
+
+    free(tasks);
+    free(elements);
+    free(index.slots);
+    parser->flags = flags;
+    parser->splitting = false;
+    return true;
+}
+
+#endif
+
+static plutosvg_document_t* plutosvg_document_load(const char* data, size_t length, float width, float height, int flags, plutosvg_arena_t* arena, plutovg_destroy_func_t destroy_func, void* closure)
+{
+#if !defined(NDEBUG)
+    check_name_tables();
+#endif
+    if(flags & (PLUTOSVG_LOAD_FLAGS_OWN_DATA | PLUTOSVG_LOAD_FLAGS_PRUNE))
+        flags &= ~PLUTOSVG_LOAD_FLAGS_LAZY;
+    plutosvg_document_t* document = plutosvg_document_create(width, height, arena, length, destroy_func, closure);
+    if(document == NULL) {
+        if(destroy_func)
+            destroy_func(closure);
+        return NULL;
+    }
+
+    plutosvg_parser_t parser;
+    parser_init(&parser, document, flags, false);
+    parser.document->flags = flags;
+#if defined(PLUTOSVG_HAS_THREADS)
+    bool failed = false;
+    if((flags & PLUTOSVG_LOAD_FLAGS_PARALLEL) && !(flags & PLUTOSVG_LOAD_FLAGS_LAZY)
+        && parser_parse_parallel(&parser, data, length, &failed)) {
+        if(failed) {
+            plutosvg_document_destroy(parser.document);
+            return NULL;
+        }
+
+        return parser_finish(&parser);
+    }
+#endif
+    size_t element_count, id_count;
+    count_source(data, length, &element_count, &id_count);
+    id_index_reserve(&parser.document->id_index, id_count);
+    if(!resize_elements(parser.document, element_count)) {
+        plutosvg_document_destroy(parser.document);
+        return NULL;
+    }
+
+    const char* it = data;
+    const char* end = it + length;
+    if(!parser_parse(&parser, &it, end, true)) {
+        plutosvg_document_destroy(parser.document);
+        return NULL;
+    }
+
+    return parser_finish(&parser);
+}
+
+plutosvg_document_t* plutosvg_document_load_from_data_with_arena(const char* data, int length, float width, float height, int flags, plutosvg_arena_t* arena, plutovg_destroy_func_t destroy_func, void* closure)
+{
+    if(length == -1)
+        return plutosvg_document_load(data, strlen(data), width, height, flags, arena, destroy_func, closure);
+    if(length < 0)
+        length = 0;
+    return plutosvg_document_load(data, length, width, height, flags, arena, destroy_func, closure);
+}
+
+plutosvg_document_t* plutosvg_document_load_from_data_with_flags(const char* data, int length, float width, float height, int flags, plutovg_destroy_func_t destroy_func, void* closure)
+{
+    return plutosvg_document_load_from_data_with_arena(data, length, width, height, flags, NULL, destroy_func, closure);
+}
+
+plutosvg_document_t* plutosvg_document_load_from_data(const char* data, int length, float width, float height, plutovg_destroy_func_t destroy_func, void* closure)
+{
+    return plutosvg_document_load_from_data_with_flags(data, length, width, height, PLUTOSVG_LOAD_FLAGS_NONE, destroy_func, closure);
+}
+
+bool plutosvg_probe_size(const char* data, int length, float width, float height, float* intrinsic_width, float* intrinsic_height, plutovg_rect_t* view_box)
+{
+    if(length == -1)
+        length = strlen(data);
+    if(length < 0)
+        length = 0;
+    plutosvg_document_t* document = plutosvg_document_create(width, height, NULL, 0, NULL, NULL);
+    if(document == NULL)
+        return false;
+    plutosvg_parser_t parser;
+    parser_init(&parser, document, PLUTOSVG_LOAD_FLAGS_NONE, false);
+    parser.probing = true;
+
+    bool success = false;
+    float w, h;
+    const char* it = data;
+    const char* end = it + length;
+    const element_t* root;
+    if(!resize_elements(parser.document, 1) || !parser_parse(&parser, &it, end, true))
+        goto cleanup;
+    if((root = parser.document->root_element) == NULL || !resolve_intrinsic_size(root, width, height, &w, &h))
+        goto cleanup;
+    if(intrinsic_width)
+        *intrinsic_width = w;
+    if(intrinsic_height)
+        *intrinsic_height = h;
+    if(view_box) {
+        view_box->x = view_box->y = view_box->w = view_box->h = 0;
+        parse_view_box(root, ATTR_VIEW_BOX, view_box);
+    }
+
+    success = true;
+cleanup:
+    plutosvg_document_destroy(parser.document);
+    return success;
+}
+
+plutosvg_parser_t* plutosvg_parser_create(float width, float height, int flags)
+{
+    plutosvg_parser_t* parser = malloc(sizeof(plutosvg_parser_t));
+    if(parser == NULL)
+        return NULL;
+    flags &= ~(PLUTOSVG_LOAD_FLAGS_LAZY | PLUTOSVG_LOAD_FLAGS_OWN_DATA | PLUTOSVG_LOAD_FLAGS_PARALLEL);
+    plutosvg_document_t* document = plutosvg_document_create(width, height, NULL, 0, NULL, NULL);
+    if(document == NULL) {
+        free(parser);
+        return NULL;
+    }
+
+    parser_init(parser, document, flags, true);
+    parser->document->flags = flags;
+    return parser;
+}
+
+static bool parser_append(plutosvg_parser_t* parser, const char* data, size_t length)
+{
+    if(parser->size + length > parser->capacity) {
+        size_t capacity = parser->capacity == 0 ? 1024 : parser->capacity;
+        while(capacity < parser->size + length)
+            capacity *= 2;
+        char* buffer = realloc(parser->buffer, capacity);
+        if(buffer == NULL)
+            return false;
+        parser->buffer = buffer;
+        parser->capacity = capacity;
+    }
+
+    memcpy(parser->buffer + parser->size, data, length);
+    parser->size += length;
+    return true;
+}
+
+static bool parser_parse_buffer(plutosvg_parser_t* parser, bool final)
+{
+    const char* it = parser->buffer;
+    const char* end = it + parser->size;
+    if(!parser_parse(parser, &it, end, final))
+        return false;
+    parser->size = end - it;
+    if(parser->size > 0)
+        memmove(parser->buffer, it, parser->size);
+    return true;
+}
+
+bool plutosvg_parser_feed(plutosvg_parser_t* parser, const char* data, size_t length)
+{
+    if(parser->failed || parser->document == NULL)
+        return false;
+    const char* it = data;
+    const char* end = it + length;
+    while(it < end && (parser->size > 0 || !parser->started)) {
+        size_t count = end - it;
+        if(!parser->started) {
+            if(count > 3 - parser->size) {
+                count = 3 - parser->size;
+            }
+        } else {
+            const char* delim = memchr(it, '>', count);
+            if(delim) {
+                count = delim - it + 1;
+            }
+        }
+
+        if(!parser_append(parser, it, count) || !parser_parse_buffer(parser, false))
+            goto error;
+        it += count;
+    }
+
+    if(it < end) {
+        if(!parser_parse(parser, &it, end, false))
+            goto error;
+        if(!parser_append(parser, it, end - it)) {
+            goto error;
+        }
+    }
+
+    return true;
+
+error:
+    parser->failed = true;
+    return false;
+}
+
+plutosvg_document_t* plutosvg_parser_finish(plutosvg_parser_t* parser)
+{
+    if(parser->failed || parser->document == NULL)
+        return NULL;
+    if(!parser_parse_buffer(parser, true)) {
+        parser->failed = true;
+        return NULL;
+    }
+
+    plutosvg_document_t* document = parser_finish(parser);
+    parser->document = NULL;
+    return document;
+}
+
+void plutosvg_parser_destroy(plutosvg_parser_t* parser)
+{
+    if(parser == NULL)
+        return;
+    plutosvg_document_destroy(parser->document);
+    free(parser->buffer);
+    free(parser);
+}
+
+static bool plutosvg_load_file(const char* filename, char** data, long* length)
+{
+    FILE* stream = fopen(filename, "rb");
+    if(stream == NULL) {
+        return false;
+    }
+
+    char* content = NULL;
+    bool success = false;
+
+    fseek(stream, 0, SEEK_END);
+    long size = ftell(stream);
+    if(size == -1L) {
+        goto cleanup;
+    }
+
+    content = malloc(size);
+    if(content == NULL) {
+        goto cleanup;
+    }
+
+    fseek(stream, 0, SEEK_SET);
+    if(fread(content, 1, size, stream) == size) {
+        *data = content;
+        *length = size;
+
+        content = NULL;
+        success = true;
+    }
+
+cleanup:
+    fclose(stream);
+    free(content);
+    return success;
+}
+
+typedef struct {
+    void* data;
+    size_t length;
+} file_mapping_t;
+
+#if defined(_WIN32)
+
+static file_mapping_t* file_mapping_create(const char* filename, int flags)
+{
+    DWORD attributes = FILE_ATTRIBUTE_NORMAL;
+    if(flags & PLUTOSVG_LOAD_FLAGS_SEQUENTIAL)
+        attributes |= FILE_FLAG_SEQUENTIAL_SCAN;
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, attributes, NULL);
+    if(file == INVALID_HANDLE_VALUE)
+        return NULL;
+    file_mapping_t* mapping = NULL;
+    HANDLE handle = NULL;
+    void* data = NULL;
+
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(file, &size) || size.QuadPart <= 0 || (ULONGLONG)(size.QuadPart) > SIZE_MAX)
+        goto cleanup;
+    handle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(handle == NULL)
+        goto cleanup;
+    data = MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0);
+    if(data == NULL)
+        goto cleanup;
+    mapping = malloc(sizeof(file_mapping_t));
+    if(mapping == NULL) {
+        UnmapViewOfFile(data);
+        goto cleanup;
+    }
+
+    mapping->data = data;
+    mapping->length = (size_t)(size.QuadPart);
+
+cleanup:
+    if(handle)
+        CloseHandle(handle);
+    CloseHandle(file);
+    return mapping;
+}
+
+static void file_mapping_advise(file_mapping_t* mapping, bool sequential)
+{
+}
+
+static void file_mapping_destroy(void* closure)
+{
+    file_mapping_t* mapping = closure;
+    UnmapViewOfFile(mapping->data);
+    free(mapping);
+}
+
+#elif defined(PLUTOSVG_HAS_MMAP)
+
+static file_mapping_t* file_mapping_create(const char* filename, int flags)
+{
+    int fd = open(filename, O_RDONLY);
+    if(fd == -1)
+        return NULL;
+    file_mapping_t* mapping = NULL;
+
+    struct stat st;
+    if(fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size <= 0 || (uintmax_t)(st.st_size) > SIZE_MAX)
+        goto cleanup;
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(data == MAP_FAILED)
+        goto cleanup;
+    mapping = malloc(sizeof(file_mapping_t));
+    if(mapping == NULL) {
+        munmap(data, st.st_size);
+        goto cleanup;
+    }
+
+    mapping->data = data;
+    mapping->length = (size_t)(st.st_size);
+    if(flags & PLUTOSVG_LOAD_FLAGS_SEQUENTIAL) {
+        posix_madvise(mapping->data, mapping->length, POSIX_MADV_SEQUENTIAL);
+    }
+
+cleanup:
+    close(fd);
+    return mapping;
+}
+
+static void file_mapping_advise(file_mapping_t* mapping, bool sequential)
+{
+    posix_madvise(mapping->data, mapping->length, sequential ? POSIX_MADV_SEQUENTIAL : POSIX_MADV_NORMAL);
+}
+
+static void file_mapping_destroy(void* closure)
+{
+    file_mapping_t* mapping = closure;
+    munmap(mapping->data, mapping->length);
+    free(mapping);
+}
+
+#else
+
+static file_mapping_t* file_mapping_create(const char* filename, int flags)
+{
+    (void)(filename);
+    (void)(flags);
+    return NULL;
+}
+
+static void file_mapping_advise(file_mapping_t* mapping, bool sequential)
+{
+    (void)(mapping);
+    (void)(sequential);
+}
+
+static void file_mapping_destroy(void* closure)
+{
+    (void)(closure);
+}
+
+#endif
+
+plutosvg_document_t* plutosvg_document_load_from_file_with_arena(const char* filename, float width, float height, int flags, plutosvg_arena_t* arena)
+{
+    file_mapping_t* mapping = file_mapping_create(filename, flags);
+    if(mapping == NULL) {
+        char* data = NULL;
+        long length = 0L;
+        if(!plutosvg_load_file(filename, &data, &length))
+            return NULL;
+        return plutosvg_document_load(data, length, width, height, flags, arena, free, data);
+    }
+
+    plutosvg_document_t* document = plutosvg_document_load(mapping->data, mapping->length, width, height, flags, arena, file_mapping_destroy, mapping);
+    if(document && (flags & PLUTOSVG_LOAD_FLAGS_SEQUENTIAL)) {
+        file_mapping_advise(mapping, false);
+    }
+
+    return document;
+}
+
+plutosvg_document_t* plutosvg_document_load_from_file_with_flags(const char* filename, float width, float height, int flags)
+{
+    return plutosvg_document_load_from_file_with_arena(filename, width, height, flags, NULL);
+}
+
+plutosvg_document_t* plutosvg_document_load_from_file(const char* filename, float width, float height)
+{
+    return plutosvg_document_load_from_file_with_flags(filename, width, height, PLUTOSVG_LOAD_FLAGS_NONE);
+}
+
+typedef struct {
+    char* data;
+    size_t size;
+    size_t capacity;
+} buffer_t;
+
+static void* buffer_append(buffer_t* buffer, const void* data, size_t size)
+{
+    if(size > buffer->capacity - buffer->size) {
+        size_t capacity = buffer->capacity == 0 ? 1024 : buffer->capacity;
+        while(size > capacity - buffer->size)
+            capacity *= 2;
+        char* newdata = realloc(buffer->data, capacity);
+        if(newdata == NULL)
+            return NULL;
+        buffer->data = newdata;
+        buffer->capacity = capacity;
+    }
+
+    char* dest = buffer->data + buffer->size;
+    if(data)
+        memcpy(dest, data, size);
+    else
+        memset(dest, 0, size);
+    buffer->size += size;
+    return dest;
+}
+
+static bool buffer_align(buffer_t* buffer, size_t alignment)
+{
+    size_t padding = (alignment - buffer->size % alignment) % alignment;
+    return padding == 0 || buffer_append(buffer, NULL, padding);
+}
+
+static bool buffer_write_file(const buffer_t* buffer, const char* filename)
+{
+    FILE* stream = fopen(filename, "wb");
+    if(stream == NULL)
+        return false;
+    bool success = fwrite(buffer->data, 1, buffer->size, stream) == buffer->size;
+    if(fclose(stream) != 0)
+        success = false;
+    return success;
+}
+
+#define COMPILED_MAGIC 0x43565350u
+#define BUNDLE_MAGIC 0x42565350u
+#define COMPILED_VERSION 2
+#define COMPILED_NONE 0xFFFFFFFFu
+
+/*
+ * Compiled documents and bundles are arrays of 32-bit words and bytes, stored little-endian on every
+ * host so that they can be generated on one machine and loaded on another. Converts `size` bytes of
+ * words between host order and that order, in either direction; little-endian hosts use them as is.
+ */
+static void swap_words(void* data, size_t size)
+{
+    const uint16_t one = 1;
+    if(*(const uint8_t*)(&one) == 1)
+        return;
+    uint8_t* bytes = data;
+    for(size_t i = 0; i + 4 <= size; i += 4) {
+        uint8_t b0 = bytes[i];
+        uint8_t b1 = bytes[i + 1];
+        bytes[i] = bytes[i + 3];
+        bytes[i + 1] = bytes[i + 2];
+        bytes[i + 2] = b1;
+        bytes[i + 3] = b0;
+    }
+}
+
+static void read_words(void* dst, const void* src, size_t size)
+{
+    memcpy(dst, src, size);
+    swap_words(dst, size);
+}
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t element_count;
+    uint32_t element_offset;
+    uint32_t attribute_count;
+    uint32_t attribute_offset;
+    uint32_t shape_count;
+    uint32_t shape_offset;
+    uint32_t point_count;
+    uint32_t point_offset;
+    uint32_t command_count;
+    uint32_t command_offset;
+    uint32_t id_count;
+    uint32_t id_offset;
+    uint32_t string_size;
+    uint32_t string_offset;
+} compiled_header_t;
+
+typedef struct {
+    uint32_t tag;
+    uint32_t parent;
+    uint32_t attribute_index;
+    uint32_t attribute_count;
+    uint32_t shape;
+} compiled_element_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t offset;
+    uint32_t length;
+} compiled_attribute_t;
+
+typedef struct {
+    uint32_t command_index;
+    uint32_t command_count;
+    uint32_t point_index;
+    uint32_t point_count;
+    plutovg_rect_t extents;
+} compiled_shape_t;
+
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+    uint32_t element;
+} compiled_id_t;
+
+typedef struct {
+    const element_t* element;
+    uint32_t index;
+} compiled_node_t;
+
+typedef struct {
+    buffer_t nodes;
+    buffer_t elements;
+    buffer_t attributes;
+    buffer_t shapes;
+    buffer_t points;
+    buffer_t commands;
+    buffer_t ids;
+    buffer_t strings;
+    buffer_t parents;
+} compiled_writer_t;
+
+static bool write_string(compiled_writer_t* writer, const string_t* value, uint32_t* offset, uint32_t* length)
+{
+    if(writer->strings.size > UINT32_MAX || value->length > UINT32_MAX)
+        return false;
+    *offset = writer->strings.size;
+    *length = value->length;
+    return value->length == 0 || buffer_append(&writer->strings, value->data, value->length);
+}
+
+static bool write_shape(compiled_writer_t* writer, const shape_t* shape, uint32_t* index)
+{
+    compiled_shape_t record;
+    record.command_index = writer->commands.size;
+    record.command_count = 0;
+    record.point_index = writer->points.size / sizeof(plutovg_point_t);
+    record.point_count = 0;
+    record.extents = shape->extents;
+
+    plutovg_path_iterator_t it;
+    plutovg_path_iterator_init(&it, shape->path);
+    while(plutovg_path_iterator_has_next(&it)) {
+        plutovg_point_t points[3];
+        uint8_t command = plutovg_path_iterator_next(&it, points);
+        int count = command == PLUTOVG_PATH_COMMAND_CUBIC_TO ? 3 : command == PLUTOVG_PATH_COMMAND_CLOSE ? 0 : 1;
+        if(!buffer_append(&writer->commands, &command, 1)
+            || !buffer_append(&writer->points, points, count * sizeof(plutovg_point_t))) {
+            return false;
+        }
+
+        record.command_count += 1;
+        record.point_count += count;
+    }
+
+    *index = writer->shapes.size / sizeof(compiled_shape_t);
+    return buffer_append(&writer->shapes, &record, sizeof(record));
+}
+
+static bool write_element(compiled_writer_t* writer, const plutosvg_document_t* document, const element_t* element)
+{
+    compiled_element_t record;
+    record.tag = element->id;
+    record.parent = COMPILED_NONE;
+    if(writer->parents.size > 0)
+        memcpy(&record.parent, writer->parents.data + writer->parents.size - sizeof(uint32_t), sizeof(uint32_t));
+    record.attribute_index = writer->attributes.size / sizeof(compiled_attribute_t);
+    record.attribute_count = 0;
+    record.shape = COMPILED_NONE;
+
+    for(uint32_t i = element->attribute_count; i > 0; --i) {
+        const attribute_t* attribute = element->attributes + i - 1;
+        compiled_attribute_t entry;
+        entry.id = attribute->id;
+        if(!write_string(writer, &attribute->value, &entry.offset, &entry.length)
+            || !buffer_append(&writer->attributes, &entry, sizeof(entry))) {
+            return false;
+        }
+
+        record.attribute_count += 1;
+    }
+
+    if(element->id == TAG_PATH || element->id == TAG_POLYLINE || element->id == TAG_POLYGON) {
+        if(!write_shape(writer, resolve_shape(document, element), &record.shape)) {
+            return false;
+        }
+    }
+
+    compiled_node_t node = {element, writer->elements.size / sizeof(compiled_element_t)};
+    return buffer_append(&writer->nodes, &node, sizeof(node))
+        && buffer_append(&writer->elements, &record, sizeof(record));
+}
+
+static int compiled_node_compare(const void* a, const void* b)
+{
+    const compiled_node_t* node_a = a;
+    const compiled_node_t* node_b = b;
+    if(node_a->element == node_b->element)
+        return 0;
+    return (uintptr_t)(node_a->element) < (uintptr_t)(node_b->element) ? -1 : 1;
+}
+
+static int compiled_id_compare(const void* a, const void* b)
+{
+    const compiled_id_t* id_a = a;
+    const compiled_id_t* id_b = b;
+    if(id_a->element == id_b->element)
+        return 0;
+    return id_a->element < id_b->element ? -1 : 1;
+}
+
+/*
+ * Writes the ids in document order rather than in slot order, so that the output does not depend on the
+ * capacity of the index, which differs between a serial and a parallel load.
+ */
+static bool write_ids(compiled_writer_t* writer, const id_index_t* id_index)
+{
+    compiled_node_t* nodes = (compiled_node_t*)(writer->nodes.data);
+    size_t count = writer->nodes.size / sizeof(compiled_node_t);
+    qsort(nodes, count, sizeof(compiled_node_t), compiled_node_compare);
+    for(size_t i = 0; i < id_index->capacity; ++i) {
+        const id_slot_t* slot = id_index->slots + i;
+        if(slot->element == NULL)
+            continue;
+        compiled_node_t key = {slot->element, 0};
+        const compiled_node_t* node = bsearch(&key, nodes, count, sizeof(compiled_node_t), compiled_node_compare);
+        compiled_id_t id;
+        id.offset = i;
+        id.length = 0;
+        id.element = node->index;
+        if(!buffer_append(&writer->ids, &id, sizeof(id))) {
+            return false;
+        }
+    }
+
+    compiled_id_t* ids = (compiled_id_t*)(writer->ids.data);
+    count = writer->ids.size / sizeof(compiled_id_t);
+    qsort(ids, count, sizeof(compiled_id_t), compiled_id_compare);
+    for(size_t i = 0; i < count; ++i) {
+        const id_slot_t* slot = id_index->slots + ids[i].offset;
+        const string_t name = {slot->data, slot->length};
+        if(!write_string(writer, &name, &ids[i].offset, &ids[i].length)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool write_section(buffer_t* output, const buffer_t* section, uint32_t* offset)
+{
+    if(!buffer_align(output, 8))
+        return false;
+    *offset = output->size;
+    return section->size == 0 || buffer_append(output, section->data, section->size);
+}
+
+static bool write_document(const plutosvg_document_t* document, buffer_t* output)
+{
+    compiled_writer_t writer;
+    memset(&writer, 0, sizeof(writer));
+
+    bool locked = document_begin_read(document);
+    bool materialized = materialize_document(document);
+    document_end_read(document, locked);
+    if(!materialized)
+        return false;
+
+    bool success = false;
+    uint32_t index = 0;
+    const element_t* element = document->root_element;
+    while(element) {
+        if(!write_element(&writer, document, element))
+            goto cleanup;
+        if(element->first_child) {
+            if(!buffer_append(&writer.parents, &index, sizeof(index)))
+                goto cleanup;
+            element = element_first_child(element);
+            ++index;
+            continue;
+        }
+
+        while(element != document->root_element && element->next_sibling == 0) {
+            element = element_parent(element);
+            writer.parents.size -= sizeof(uint32_t);
+        }
+
+        if(element == document->root_element)
+            break;
+        element = element_next_sibling(element);
+        ++index;
+    }
+
+    if(!write_ids(&writer, &document->id_index))
+        goto cleanup;
+    swap_words(writer.elements.data, writer.elements.size);
+    swap_words(writer.attributes.data, writer.attributes.size);
+    swap_words(writer.shapes.data, writer.shapes.size);
+    swap_words(writer.points.data, writer.points.size);
+    swap_words(writer.ids.data, writer.ids.size);
+    size_t start = output->size;
+    compiled_header_t header;
+    if(!buffer_append(output, NULL, sizeof(header))
+        || !write_section(output, &writer.elements, &header.element_offset)
+        || !write_section(output, &writer.attributes, &header.attribute_offset)
+        || !write_section(output, &writer.shapes, &header.shape_offset)
+        || !write_section(output, &writer.points, &header.point_offset)
+        || !write_section(output, &writer.commands, &header.command_offset)
+        || !write_section(output, &writer.ids, &header.id_offset)
+        || !write_section(output, &writer.strings, &header.string_offset)
+        || !buffer_align(output, 8)) {
+        goto cleanup;
+    }
+
+    if(output->size - start > UINT32_MAX)
+        goto cleanup;
+    header.magic = COMPILED_MAGIC;
+    header.version = COMPILED_VERSION;
+    header.size = output->size - start;
+    header.element_count = writer.elements.size / sizeof(compiled_element_t);
+    header.attribute_count = writer.attributes.size / sizeof(compiled_attribute_t);
+    header.shape_count = writer.shapes.size / sizeof(compiled_shape_t);
+    header.point_count = writer.points.size / sizeof(plutovg_point_t);
+    header.command_count = writer.commands.size;
+    header.id_count = writer.ids.size / sizeof(compiled_id_t);
+    header.string_size = writer.strings.size;
+    header.element_offset -= start;
+    header.attribute_offset -= start;
+    header.shape_offset -= start;
+    header.point_offset -= start;
+    header.command_offset -= start;
+    header.id_offset -= start;
+    header.string_offset -= start;
+    swap_words(&header, sizeof(header));
+    memcpy(output->data + start, &header, sizeof(header));
+    success = true;
+
+cleanup:
+    free(writer.nodes.data);
+    free(writer.elements.data);
+    free(writer.attributes.data);
+    free(writer.shapes.data);
+    free(writer.points.data);
+    free(writer.commands.data);
+    free(writer.ids.data);
+    free(writer.strings.data);
+    free(writer.parents.data);
+    return success;
+}
+
+bool plutosvg_document_write_compiled(const plutosvg_document_t* document, plutovg_write_func_t write_func, void* closure)
+{
+    buffer_t output = {NULL, 0, 0};
+    bool success = write_document(document, &output) && output.size <= INT_MAX;
+    if(success)
+        write_func(closure, output.data, output.size);
+    free(output.data);
+    return success;
+}
+
+bool plutosvg_document_save_compiled(const plutosvg_document_t* document, const char* filename)
+{
+    buffer_t output = {NULL, 0, 0};
+    bool success = write_document(document, &output) && buffer_write_file(&output, filename);
+    free(output.data);
+    return success;
+}
+
+static bool check_section(const compiled_header_t* header, uint32_t offset, uint32_t count, size_t size)
+{
+    return offset <= header->size && count <= (header->size - offset) / size;
+}
+
+static const shape_t* read_shape(plutosvg_document_t* document, const char* data, const compiled_header_t* header, uint32_t index)
+{
+    compiled_shape_t record;
+    read_words(&record, (const compiled_shape_t*)(data + header->shape_offset) + index, sizeof(record));
+    if(record.command_index > header->command_count || record.command_count > header->command_count - record.command_index
+        || record.point_index > header->point_count || record.point_count > header->point_count - record.point_index) {
+        return NULL;
+    }
+
+    const uint8_t* commands = (const uint8_t*)(data + header->command_offset) + record.command_index;
+    const plutovg_point_t* points = (const plutovg_point_t*)(data + header->point_offset) + record.point_index;
+    const plutovg_point_t* points_end = points + record.point_count;
+
+    shape_t* shape = arena_alloc(document->arena, sizeof(shape_t));
+    shape->path = plutovg_path_create();
+    shape->extents = record.extents;
+    plutovg_path_reserve(shape->path, record.command_count + record.point_count);
+    for(uint32_t i = 0; i < record.command_count; ++i) {
+        int count = commands[i] == PLUTOVG_PATH_COMMAND_CUBIC_TO ? 3 : commands[i] == PLUTOVG_PATH_COMMAND_CLOSE ? 0 : 1;
+        if(points_end - points < count)
+            goto error;
+        plutovg_point_t p[3];
+        read_words(p, points, count * sizeof(plutovg_point_t));
+        points += count;
+        switch(commands[i]) {
+        case PLUTOVG_PATH_COMMAND_MOVE_TO:
+            plutovg_path_move_to(shape->path, p[0].x, p[0].y);
+            break;
+        case PLUTOVG_PATH_COMMAND_LINE_TO:
+            plutovg_path_line_to(shape->path, p[0].x, p[0].y);
+            break;
+        case PLUTOVG_PATH_COMMAND_CUBIC_TO:
+            plutovg_path_cubic_to(shape->path, p[0].x, p[0].y, p[1].x, p[1].y, p[2].x, p[2].y);
+            break;
+        case PLUTOVG_PATH_COMMAND_CLOSE:
+            plutovg_path_close(shape->path);
+            break;
+        default:
+            goto error;
+        }
+    }
+
+    if(points == points_end)
+        return shape;
+error:
+    plutovg_path_destroy(shape->path);
+    return NULL;
+}
+
+static plutosvg_document_t* plutosvg_document_load_compiled(const char* data, size_t length, float width, float height, int flags, plutovg_destroy_func_t destroy_func, void* closure)
+{
+    plutosvg_document_t* document = plutosvg_document_create(width, height, NULL, length, destroy_func, closure);
+    if(document == NULL) {
+        if(destroy_func)
+            destroy_func(closure);
+        return NULL;
+    }
+
+    document->flags = flags;
+
+    compiled_header_t header;
+    if(((uintptr_t)(data) & 3) || length < sizeof(compiled_header_t))
+        goto error;
+    read_words(&header, data, sizeof(header));
+    if(header.magic != COMPILED_MAGIC || header.version != COMPILED_VERSION || header.size > length
+        || header.element_count == 0
+        || !check_section(&header, header.element_offset, header.element_count, sizeof(compiled_element_t))
+        || !check_section(&header, header.attribute_offset, header.attribute_count, sizeof(compiled_attribute_t))
+        || !check_section(&header, header.shape_offset, header.shape_count, sizeof(compiled_shape_t))
+        || !check_section(&header, header.point_offset, header.point_count, sizeof(plutovg_point_t))
+        || !check_section(&header, header.command_offset, header.command_count, sizeof(uint8_t))
+        || !check_section(&header, header.id_offset, header.id_count, sizeof(compiled_id_t))
+        || !check_section(&header, header.string_offset, header.string_size, sizeof(char))
+        || (header.element_offset | header.attribute_offset | header.shape_offset | header.point_offset | header.id_offset) & 3) {
+        goto error;
+    }
+
+    if(!resize_elements(document, header.element_count))
+        goto error;
+    element_t* elements = document->elements;
+    const char* strings = data + header.string_offset;
+    const compiled_element_t* element_records = (const compiled_element_t*)(data + header.element_offset);
+    const compiled_attribute_t* attribute_records = (const compiled_attribute_t*)(data + header.attribute_offset);
+    for(uint32_t i = 0; i < header.element_count; ++i) {
+        compiled_element_t record;
+        read_words(&record, element_records + i, sizeof(record));
+        if(record.tag == TAG_UNKNOWN || record.tag >= TAG_COUNT
+            || (i == 0 ? record.parent != COMPILED_NONE || record.tag != TAG_SVG : record.parent >= i)
+            || record.attribute_index > header.attribute_count
+            || record.attribute_count > header.attribute_count - record.attribute_index
+            || (record.shape != COMPILED_NONE && record.shape >= header.shape_count)) {
             goto error;
-        if(it < end && *it == '>') {
-            if(element)
-                current = element;
-            ++it;
-            continue;
         }
 
-        if(it < end && *it == '/') {
-            ++it;
-            if(it >= end || *it != '>')
+        element_t* element = create_element(document, i == 0 ? NULL : elements + record.parent, record.tag);
+        attribute_t* attributes = NULL;
+        if(record.attribute_count > 0)
+            attributes = arena_alloc(document->arena, record.attribute_count * sizeof(attribute_t));
+        for(uint32_t j = 0; j < record.attribute_count; ++j) {
+            compiled_attribute_t attribute;
+            read_words(&attribute, attribute_records + record.attribute_index + record.attribute_count - j - 1, sizeof(attribute));
+            if(attribute.id == ATTR_UNKNOWN || attribute.id >= ATTR_COUNT
+                || attribute.offset > header.string_size || attribute.length > header.string_size - attribute.offset) {
                 goto error;
-            if(ignoring > 0)
-                --ignoring;
-            ++it;
-            continue;
+            }
+
+            add_attribute(element, attributes + j, attribute.id, strings + attribute.offset, attribute.length);
         }
 
-        goto error;
-    }
+        element->attributes = attributes;
+        element->attribute_count = record.attribute_count;
 
-    if(it == end && ignoring == 0 && current == NULL && document->root_element) {
-        length_t w = {100, length_type_percent};
-        length_t h = {100, length_type_percent};
-
-        parse_length(document->root_element, ATTR_WIDTH, &w, false, false);
-        parse_length(document->root_element, ATTR_HEIGHT, &h, false, false);
-
-        float intrinsic_width = convert_length(&w, width);
-        float intrinsic_height = convert_length(&h, height);
-        if(intrinsic_width <= 0.f || intrinsic_height <= 0.f) {
-            plutovg_rect_t view_box = {0, 0, 0, 0};
-            if(parse_view_box(document->root_element, ATTR_VIEW_BOX, &view_box)) {
-                float intrinsic_ratio = view_box.w / view_box.h;
-                if(intrinsic_width <= 0.f && intrinsic_height > 0.f) {
-                    intrinsic_width = intrinsic_height * intrinsic_ratio;
-                } else if(intrinsic_width > 0.f && intrinsic_height <= 0.f) {
-                    intrinsic_height = intrinsic_width / intrinsic_ratio;
-                } else {
-                    intrinsic_width = view_box.w;
-                    intrinsic_height = view_box.h;
-                }
-            } else {
-                if(intrinsic_width == -1)
-                    intrinsic_width = 300;
-                if(intrinsic_height == -1) {
-                    intrinsic_height = 150;
-                }
+        if(record.shape != COMPILED_NONE) {
+            if(element->id != TAG_PATH && element->id != TAG_POLYLINE && element->id != TAG_POLYGON)
+                goto error;
+            if((element->shape = read_shape(document, data, &header, record.shape)) == NULL) {
+                goto error;
             }
         }
+    }
 
-        if(intrinsic_width <= 0.f || intrinsic_height <= 0.f)
+    const compiled_id_t* ids = (const compiled_id_t*)(data + header.id_offset);
+    id_index_reserve(&document->id_index, header.id_count);
+    for(uint32_t i = 0; i < header.id_count; ++i) {
+        compiled_id_t id;
+        read_words(&id, ids + i, sizeof(id));
+        if(id.element >= header.element_count || id.offset > header.string_size || id.length > header.string_size - id.offset)
             goto error;
-        document->width = intrinsic_width;
-        document->height = intrinsic_height;
-        return document;
+        id_index_put(&document->id_index, strings + id.offset, id.length, elements + id.element);
     }
 
+    return finish_document(document, flags);
 error:
     plutosvg_document_destroy(document);
     return NULL;
 }
 
-static bool plutosvg_load_file(const char* filename, char** data, long* length)
+plutosvg_document_t* plutosvg_document_load_compiled_from_data(const void* data, size_t length, float width, float height, int flags, plutovg_destroy_func_t destroy_func, void* closure)
 {
-    FILE* stream = fopen(filename, "rb");
-    if(stream == NULL) {
-        return false;
+    return plutosvg_document_load_compiled(data, length, width, height, flags, destroy_func, closure);
+}
+
+plutosvg_document_t* plutosvg_document_load_compiled_from_file(const char* filename, float width, float height, int flags)
+{
+    file_mapping_t* mapping = file_mapping_create(filename, flags);
+    if(mapping == NULL) {
+        char* data = NULL;
+        long length = 0L;
+        if(!plutosvg_load_file(filename, &data, &length))
+            return NULL;
+        return plutosvg_document_load_compiled(data, length, width, height, flags, free, data);
     }
 
-    char* content = NULL;
-    bool success = false;
+    return plutosvg_document_load_compiled(mapping->data, mapping->length, width, height, flags, file_mapping_destroy, mapping);
+}
 
-    fseek(stream, 0, SEEK_END);
-    long size = ftell(stream);
-    if(size == -1L) {
-        goto cleanup;
-    }
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t count;
+} bundle_header_t;
 
-    content = malloc(size);
-    if(content == NULL) {
+typedef struct {
+    uint32_t name_offset;
+    uint32_t name_length;
+    uint32_t offset;
+    uint32_t size;
+} bundle_entry_t;
+
+struct plutosvg_bundle {
+    int ref;
+    mutex_t lock;
+    const char* data;
+    size_t length;
+    uint32_t count;
+    plutovg_destroy_func_t destroy_func;
+    void* closure;
+};
+
+typedef struct {
+    const char* name;
+    size_t length;
+    const plutosvg_document_t* document;
+} bundle_item_t;
+
+static int bundle_compare_names(const char* a, size_t a_length, const char* b, size_t b_length)
+{
+    int result = memcmp(a, b, MIN(a_length, b_length));
+    if(result == 0 && a_length != b_length)
+        return a_length < b_length ? -1 : 1;
+    return result;
+}
+
+static int bundle_item_compare(const void* a, const void* b)
+{
+    const bundle_item_t* item_a = a;
+    const bundle_item_t* item_b = b;
+    return bundle_compare_names(item_a->name, item_a->length, item_b->name, item_b->length);
+}
+
+bool plutosvg_bundle_save(const char* filename, const plutosvg_document_t* const documents[], const char* const names[], int count)
+{
+    if(count < 0)
+        return false;
+    buffer_t output = {NULL, 0, 0};
+    bundle_item_t* items = malloc((count + 1) * sizeof(bundle_item_t));
+    bool success = false;
+    if(items == NULL)
         goto cleanup;
+    for(int i = 0; i < count; ++i) {
+        items[i].name = names[i];
+        items[i].length = strlen(names[i]);
+        items[i].document = documents[i];
     }
 
-    fseek(stream, 0, SEEK_SET);
-    if(fread(content, 1, size, stream) == size) {
-        *data = content;
-        *length = size;
+    qsort(items, count, sizeof(bundle_item_t), bundle_item_compare);
+    for(int i = 1; i < count; ++i) {
+        if(bundle_item_compare(items + i - 1, items + i) == 0) {
+            goto cleanup;
+        }
+    }
 
-        content = NULL;
-        success = true;
+    size_t entries_offset = sizeof(bundle_header_t);
+    if(!buffer_append(&output, NULL, entries_offset + count * sizeof(bundle_entry_t)))
+        goto cleanup;
+    for(int i = 0; i < count; ++i) {
+        bundle_entry_t entry;
+        entry.name_offset = output.size;
+        entry.name_length = items[i].length;
+        if(!buffer_append(&output, items[i].name, items[i].length) || !buffer_align(&output, 8))
+            goto cleanup;
+        entry.offset = output.size;
+        if(!write_document(items[i].document, &output) || output.size > UINT32_MAX)
+            goto cleanup;
+        entry.size = output.size - entry.offset;
+        swap_words(&entry, sizeof(entry));
+        memcpy(output.data + entries_offset + i * sizeof(bundle_entry_t), &entry, sizeof(entry));
     }
 
+    bundle_header_t header = {BUNDLE_MAGIC, COMPILED_VERSION, output.size, count};
+    swap_words(&header, sizeof(header));
+    memcpy(output.data, &header, sizeof(header));
+    success = buffer_write_file(&output, filename);
+
 cleanup:
-    fclose(stream);
-    free(content);
+    free(items);
+    free(output.data);
     return success;
 }
 
-plutosvg_document_t* plutosvg_document_load_from_file(const char* filename, float width, float height)
+plutosvg_bundle_t* plutosvg_bundle_open(const char* filename)
+{
+    const char* data = NULL;
+    size_t length = 0;
+    plutovg_destroy_func_t destroy_func = file_mapping_destroy;
+    void* closure = file_mapping_create(filename, PLUTOSVG_LOAD_FLAGS_NONE);
+    if(closure == NULL) {
+        char* buffer = NULL;
+        long buffer_length = 0L;
+        if(!plutosvg_load_file(filename, &buffer, &buffer_length))
+            return NULL;
+        data = buffer;
+        length = buffer_length;
+        destroy_func = free;
+        closure = buffer;
+    } else {
+        file_mapping_t* mapping = closure;
+        data = mapping->data;
+        length = mapping->length;
+    }
+
+    bundle_header_t header;
+    if(length >= sizeof(bundle_header_t))
+        read_words(&header, data, sizeof(header));
+    if(length < sizeof(bundle_header_t) || header.magic != BUNDLE_MAGIC || header.version != COMPILED_VERSION
+        || header.size > length || header.count > (header.size - sizeof(bundle_header_t)) / sizeof(bundle_entry_t)) {
+        destroy_func(closure);
+        return NULL;
+    }
+
+    plutosvg_bundle_t* bundle = malloc(sizeof(plutosvg_bundle_t));
+    if(bundle == NULL) {
+        destroy_func(closure);
+        return NULL;
+    }
+
+    bundle->ref = 1;
+    mutex_init(&bundle->lock);
+    bundle->data = data;
+    bundle->length = header.size;
+    bundle->count = header.count;
+    bundle->destroy_func = destroy_func;
+    bundle->closure = closure;
+    return bundle;
+}
+
+int plutosvg_bundle_get_count(const plutosvg_bundle_t* bundle)
+{
+    return bundle->count;
+}
+
+static void read_bundle_entry(const plutosvg_bundle_t* bundle, size_t index, bundle_entry_t* entry)
+{
+    read_words(entry, bundle->data + sizeof(bundle_header_t) + index * sizeof(bundle_entry_t), sizeof(bundle_entry_t));
+}
+
+const char* plutosvg_bundle_get_name(const plutosvg_bundle_t* bundle, int index, int* length)
 {
-    char* data = NULL;
-    long length = 0L;
-    if(!plutosvg_load_file(filename, &data, &length))
+    if(index < 0 || (uint32_t)(index) >= bundle->count)
+        return NULL;
+    bundle_entry_t entry;
+    read_bundle_entry(bundle, index, &entry);
+    if(entry.name_offset > bundle->length || entry.name_length > bundle->length - entry.name_offset) {
         return NULL;
-    return plutosvg_document_load_from_data(data, length, width, height, free, data);
+    }
+
+    if(length)
+        *length = entry.name_length;
+    return bundle->data + entry.name_offset;
+}
+
+static void bundle_release(void* closure)
+{
+    plutosvg_bundle_destroy(closure);
+}
+
+plutosvg_document_t* plutosvg_bundle_load(plutosvg_bundle_t* bundle, const char* name, float width, float height, int flags)
+{
+    size_t length = strlen(name);
+    size_t lower = 0;
+    size_t upper = bundle->count;
+    while(lower < upper) {
+        size_t middle = lower + (upper - lower) / 2;
+        bundle_entry_t entry;
+        read_bundle_entry(bundle, middle, &entry);
+        if(entry.name_offset > bundle->length || entry.name_length > bundle->length - entry.name_offset)
+            return NULL;
+        int result = bundle_compare_names(name, length, bundle->data + entry.name_offset, entry.name_length);
+        if(result < 0) {
+            upper = middle;
+        } else if(result > 0) {
+            lower = middle + 1;
+        } else {
+            if(entry.offset > bundle->length || entry.size > bundle->length - entry.offset)
+                return NULL;
+            mutex_lock(&bundle->lock);
+            ++bundle->ref;
+            mutex_unlock(&bundle->lock);
+            return plutosvg_document_load_compiled(bundle->data + entry.offset, entry.size, width, height, flags, bundle_release, bundle);
+        }
+    }
+
+    return NULL;
+}
+
+void plutosvg_bundle_destroy(plutosvg_bundle_t* bundle)
+{
+    if(bundle == NULL)
+        return;
+    mutex_lock(&bundle->lock);
+    int ref = --bundle->ref;
+    mutex_unlock(&bundle->lock);
+    if(ref > 0)
+        return;
+    mutex_destroy(&bundle->lock);
+    bundle->destroy_func(bundle->closure);
+    free(bundle);
 }
 
 typedef enum render_mode {
@@ -1531,9 +4655,34 @@ typedef enum render_mode {
     render_mode_bounding
 } render_mode_t;
 
+struct plutosvg_display_list {
+    plutosvg_arena_t* arena;
+    plutosvg_command_t* commands;
+    int count;
+    int capacity;
+    plutovg_rect_t extents;
+    bool failed;
+};
+
+typedef struct {
+    const plutosvg_document_t* document;
+    plutovg_canvas_t* canvas;
+    const plutovg_color_t* current_color;
+    plutosvg_palette_func_t palette_func;
+    void* closure;
+    int depth;
+    plutosvg_display_list_t* list;
+    plutovg_path_t* path;
+    plutovg_rect_t clip;
+    bool truncated;
+    bool cull_groups;
+} render_context_t;
+
 typedef struct render_state {
     struct render_state* parent;
     const element_t* element;
+    const style_t* style;
+    style_t style_storage;
     render_mode_t mode;
     float opacity;
 
@@ -1550,20 +4699,56 @@ typedef struct render_state {
 #define IS_INVALID_RECT(rect) ((rect).w < 0 || (rect).h < 0)
 #define IS_EMPTY_RECT(rect) ((rect).w <= 0 || (rect).h <= 0)
 
+/*
+ * Returns the element that `element` inherits from when rendered below `parent`; an element referenced
+ * by <use> inherits from the <use> element rather than from its own parent.
+ */
+static const element_t* resolve_parent_element(const element_t* element, const render_state_t* parent)
+{
+    if(parent->element != element && parent->element->id == TAG_USE)
+        return parent->element;
+    return element_parent(element);
+}
+
+/*
+ * Returns the style of an element rendered below `parent`. It is the style computed at load time unless
+ * the element inherits from a <use> element, directly or through a parent rendered that way, in which case
+ * it is computed from the parent's style into `storage`.
+ */
+static const style_t* resolve_state_style(const element_t* element, const render_state_t* parent, style_t* storage)
+{
+    const element_t* parent_element = resolve_parent_element(element, parent);
+    if(parent->element != parent_element || (parent_element == element_parent(element) && parent->style == parent_element->style))
+        return element->style;
+    return inherit_style(storage, parent->style, element);
+}
+
+static inline const element_t* style_element(const style_t* style, int id)
+{
+    return style ? style->sources[STYLE_INDEX(id)] : NULL;
+}
+
 static void render_state_begin(const element_t* element, render_state_t* state, render_state_t* parent)
 {
     state->parent = parent;
     state->element = element;
+    state->style = resolve_state_style(element, parent, &state->style_storage);
     state->mode = parent->mode;
     state->opacity = parent->opacity;
-    state->matrix = parent->matrix;
     state->extents = INVALID_RECT;
 
     state->view_width = parent->view_width;
     state->view_height = parent->view_height;
 
-    if(element->parent && parse_transform(element, ATTR_TRANSFORM, &state->matrix))
-        plutovg_matrix_multiply(&state->matrix, &state->matrix, &parent->matrix);
+    if(state->mode == render_mode_bounding) {
+        plutovg_matrix_init_identity(&state->matrix);
+    } else {
+        state->matrix = parent->matrix;
+    }
+
+    plutovg_matrix_t transform;
+    if(resolve_parent_element(element, parent) && parse_transform(element, ATTR_TRANSFORM, &transform))
+        plutovg_matrix_multiply(&state->matrix, &transform, &state->matrix);
     if(state->mode == render_mode_painting) {
         if(parse_number(element, ATTR_OPACITY, &state->opacity, true, false)) {
             state->opacity *= parent->opacity;
@@ -1571,6 +4756,10 @@ static void render_state_begin(const element_t* element, render_state_t* state,
     }
 }
 
+/*
+ * Adds the extents of a state to those of its parent. In a bounding pass the matrix of a state is relative
+ * to its parent rather than to the device, so the extents map straight into the parent's user space.
+ */
 static void render_state_end(render_state_t* state)
 {
     if(state->mode == render_mode_painting)
@@ -1579,12 +4768,8 @@ static void render_state_end(render_state_t* state)
         return;
     }
 
-    plutovg_matrix_t matrix;
-    plutovg_matrix_invert(&state->parent->matrix, &matrix);
-    plutovg_matrix_multiply(&matrix, &state->matrix, &matrix);
-
     plutovg_rect_t extents;
-    plutovg_matrix_map_rect(&matrix, &state->extents, &extents);
+    plutovg_matrix_map_rect(&state->matrix, &state->extents, &extents);
     if(IS_INVALID_RECT(state->parent->extents)) {
         state->parent->extents = extents;
         return;
@@ -1611,15 +4796,6 @@ static bool has_cycle_reference(const render_state_t* state, const element_t* el
     return false;
 }
 
-typedef struct {
-    const plutosvg_document_t* document;
-    plutovg_canvas_t* canvas;
-    const plutovg_color_t* current_color;
-    plutosvg_palette_func_t palette_func;
-    void* closure;
-    int depth;
-} render_context_t;
-
 static float resolve_length(const render_state_t* state, const length_t* length, char mode)
 {
     float maximum = 0.f;
@@ -1638,9 +4814,16 @@ static float resolve_length(const render_state_t* state, const length_t* length,
 
 static element_t* find_element(const plutosvg_document_t* document, const string_t* id)
 {
-    if(document->id_cache && id->length > 0)
-        return hashmap_get(document->id_cache, id->data, id->length);
-    return NULL;
+    if(id->length == 0)
+        return NULL;
+    element_t* element = id_index_get(&document->id_index, id->data, id->length);
+    if(element && element->subtree) {
+        if(!materialize_element(document, element))
+            return NULL;
+        element = id_index_get(&document->id_index, id->data, id->length);
+    }
+
+    return element;
 }
 
 static element_t* resolve_href(const plutosvg_document_t* document, const element_t* element)
@@ -1661,26 +4844,41 @@ static plutovg_color_t convert_color(const color_t* color)
     return value;
 }
 
-static plutovg_color_t resolve_current_color(render_context_t* context, const element_t* element)
+/*
+ * Returns the element `element` inherits from, following the <use> references rendered in `state`.
+ */
+static const element_t* resolve_inherited_parent(const render_state_t* state, const element_t* element)
+{
+    for(; state->parent; state = state->parent) {
+        if(state->element == element) {
+            return resolve_parent_element(element, state->parent);
+        }
+    }
+
+    return element_parent(element);
+}
+
+static plutovg_color_t resolve_current_color(render_context_t* context, const render_state_t* state, const element_t* element)
 {
     color_t color = {color_type_current};
     parse_color(element, ATTR_COLOR, &color, true);
     if(color.type == color_type_fixed)
         return convert_color(&color);
-    if(element->parent == NULL) {
+    const element_t* parent = element ? resolve_inherited_parent(state, element) : NULL;
+    if(parent == NULL) {
         if(context->current_color)
             return *context->current_color;
         return PLUTOVG_BLACK_COLOR;
     }
 
-    return resolve_current_color(context, element->parent);
+    return resolve_current_color(context, state, parent);
 }
 
-static plutovg_color_t resolve_color(render_context_t* context, const element_t* element, const color_t* color)
+static plutovg_color_t resolve_color(render_context_t* context, const render_state_t* state, const element_t* element, const color_t* color)
 {
     if(color->type == color_type_fixed)
         return convert_color(color);
-    return resolve_current_color(context, element);
+    return resolve_current_color(context, state, element);
 }
 
 #define MAX_STOPS 64
@@ -1690,9 +4888,9 @@ typedef struct {
     size_t size;
 } gradient_stop_array_t;
 
-static void resolve_gradient_stops(render_context_t* context, const element_t* element, gradient_stop_array_t* stops)
+static void resolve_gradient_stops(render_context_t* context, const render_state_t* state, const element_t* element, gradient_stop_array_t* stops)
 {
-    const element_t* child = element->first_child;
+    const element_t* child = element_first_child(element);
     while(child && stops->size < MAX_STOPS) {
         if(child->id == TAG_STOP) {
             float offset = 0.f;
@@ -1704,12 +4902,12 @@ static void resolve_gradient_stops(render_context_t* context, const element_t* e
             parse_color(child, ATTR_STOP_COLOR, &stop_color, false);
 
             stops->data[stops->size].offset = offset;
-            stops->data[stops->size].color = resolve_color(context, child, &stop_color);
+            stops->data[stops->size].color = resolve_color(context, state, child, &stop_color);
             stops->data[stops->size].color.a *= stop_opacity;
             stops->size += 1;
         }
 
-        child = child->next_sibling;
+        child = element_next_sibling(child);
     }
 }
 
@@ -1736,7 +4934,7 @@ static void collect_gradient_attributes(const element_t* element, gradient_attri
     if(attributes->transform == NULL && has_attribute(element, ATTR_GRADIENT_TRANSFORM))
         attributes->transform = element;
     if(attributes->stops == NULL) {
-        for(const element_t* child = element->first_child; child; child = child->next_sibling) {
+        for(const element_t* child = element_first_child(element); child; child = element_next_sibling(child)) {
             if(child->id == TAG_STOP) {
                 attributes->stops = element;
                 break;
@@ -1760,7 +4958,7 @@ static void resolve_gradient_attributes(render_context_t* context, const render_
     parse_units_type(attributes->units, ATTR_GRADIENT_UNITS, units);
     parse_spread_method(attributes->spread, ATTR_SPREAD_METHOD, spread);
     parse_transform(attributes->transform, ATTR_GRADIENT_TRANSFORM, transform);
-    resolve_gradient_stops(context, attributes->stops, stops);
+    resolve_gradient_stops(context, state, attributes->stops, stops);
     if(*units == units_type_object_bounding_box) {
         plutovg_matrix_t matrix;
         plutovg_matrix_init_translate(&matrix, state->extents.x, state->extents.y);
@@ -1779,7 +4977,7 @@ typedef struct {
 
 #define MAX_GRADIENT_DEPTH 128
 
-static bool apply_linear_gradient(render_state_t* state, render_context_t* context, const element_t* element)
+static bool resolve_linear_gradient(render_state_t* state, render_context_t* context, const element_t* element, plutosvg_paint_t* paint, gradient_stop_array_t* stops)
 {
     linear_gradient_attributes_t attributes = {0};
     const element_t* current = element;
@@ -1812,11 +5010,12 @@ static bool apply_linear_gradient(render_state_t* state, render_context_t* conte
     if(attributes.y2 == NULL) attributes.y2 = element;
 
     units_type_t units = units_type_object_bounding_box;
-    plutovg_spread_method_t spread = PLUTOVG_SPREAD_METHOD_PAD;
-    plutovg_matrix_t transform = PLUTOVG_IDENTITY_MATRIX;
-    gradient_stop_array_t stops = {0};
+    paint->type = PLUTOSVG_PAINT_TYPE_LINEAR_GRADIENT;
+    paint->spread = PLUTOVG_SPREAD_METHOD_PAD;
+    paint->matrix = PLUTOVG_IDENTITY_MATRIX;
+    stops->size = 0;
 
-    resolve_gradient_attributes(context, state, &attributes.base, &units, &spread, &transform, &stops);
+    resolve_gradient_attributes(context, state, &attributes.base, &units, &paint->spread, &paint->matrix, stops);
 
     length_t x1 = {0, length_type_fixed};
     length_t y1 = {0, length_type_fixed};
@@ -1828,12 +5027,12 @@ static bool apply_linear_gradient(render_state_t* state, render_context_t* conte
     parse_length(attributes.x2, ATTR_X2, &x2, true, false);
     parse_length(attributes.y2, ATTR_Y2, &y2, true, false);
 
-    float _x1 = resolve_gradient_length(state, &x1, units, 'x');
-    float _y1 = resolve_gradient_length(state, &y1, units, 'y');
-    float _x2 = resolve_gradient_length(state, &x2, units, 'x');
-    float _y2 = resolve_gradient_length(state, &y2, units, 'y');
-
-    plutovg_canvas_set_linear_gradient(context->canvas, _x1, _y1, _x2, _y2, spread, stops.data, stops.size, &transform);
+    paint->values[0] = resolve_gradient_length(state, &x1, units, 'x');
+    paint->values[1] = resolve_gradient_length(state, &y1, units, 'y');
+    paint->values[2] = resolve_gradient_length(state, &x2, units, 'x');
+    paint->values[3] = resolve_gradient_length(state, &y2, units, 'y');
+    paint->stops = stops->data;
+    paint->stop_count = (int)(stops->size);
     return true;
 }
 
@@ -1846,7 +5045,7 @@ typedef struct {
     const element_t* fy;
 } radial_gradient_attributes_t;
 
-static bool apply_radial_gradient(render_state_t* state, render_context_t* context, const element_t* element)
+static bool resolve_radial_gradient(render_state_t* state, render_context_t* context, const element_t* element, plutosvg_paint_t* paint, gradient_stop_array_t* stops)
 {
     radial_gradient_attributes_t attributes = {0};
     const element_t* current = element;
@@ -1880,11 +5079,12 @@ static bool apply_radial_gradient(render_state_t* state, render_context_t* conte
     if(attributes.r == NULL) attributes.r = element;
 
     units_type_t units = units_type_object_bounding_box;
-    plutovg_spread_method_t spread = PLUTOVG_SPREAD_METHOD_PAD;
-    plutovg_matrix_t transform = PLUTOVG_IDENTITY_MATRIX;
-    gradient_stop_array_t stops = {0};
+    paint->type = PLUTOSVG_PAINT_TYPE_RADIAL_GRADIENT;
+    paint->spread = PLUTOVG_SPREAD_METHOD_PAD;
+    paint->matrix = PLUTOVG_IDENTITY_MATRIX;
+    stops->size = 0;
 
-    resolve_gradient_attributes(context, state, &attributes.base, &units, &spread, &transform, &stops);
+    resolve_gradient_attributes(context, state, &attributes.base, &units, &paint->spread, &paint->matrix, stops);
 
     length_t cx = {50, length_type_percent};
     length_t cy = {50, length_type_percent};
@@ -1908,78 +5108,240 @@ static bool apply_radial_gradient(render_state_t* state, render_context_t* conte
         parse_length(attributes.cy, ATTR_CY, &fy, true, false);
     }
 
-    float _cx = resolve_gradient_length(state, &cx, units, 'x');
-    float _cy = resolve_gradient_length(state, &cy, units, 'y');
-    float _r = resolve_gradient_length(state, &r, units, 'o');
-    float _fx = resolve_gradient_length(state, &fx, units, 'x');
-    float _fy = resolve_gradient_length(state, &fy, units, 'y');
-
-    plutovg_canvas_set_radial_gradient(context->canvas, _cx, _cy, _r, _fx, _fy, 0.f, spread, stops.data, stops.size, &transform);
+    paint->values[0] = resolve_gradient_length(state, &cx, units, 'x');
+    paint->values[1] = resolve_gradient_length(state, &cy, units, 'y');
+    paint->values[2] = resolve_gradient_length(state, &r, units, 'o');
+    paint->values[3] = resolve_gradient_length(state, &fx, units, 'x');
+    paint->values[4] = resolve_gradient_length(state, &fy, units, 'y');
+    paint->values[5] = 0.f;
+    paint->stops = stops->data;
+    paint->stop_count = (int)(stops->size);
     return true;
 }
 
-static bool apply_paint(render_state_t* state, render_context_t* context, const paint_t* paint)
+/*
+ * Resolves a paint to what the canvas needs; gradient stops are written to `stops`, which must outlive the use of `out`.
+ */
+static bool resolve_paint(render_state_t* state, render_context_t* context, const paint_t* paint, plutosvg_paint_t* out, gradient_stop_array_t* stops)
 {
     if(paint->type == paint_type_none)
         return false;
+    out->type = PLUTOSVG_PAINT_TYPE_COLOR;
+    out->texture = NULL;
     if(paint->type == paint_type_color) {
-        plutovg_color_t color = resolve_color(context, state->element, &paint->color);
-        plutovg_canvas_set_color(context->canvas, &color);
+        out->color = resolve_color(context, state, style_element(state->style, ATTR_COLOR), &paint->color);
         return true;
     }
 
     if(paint->type == paint_type_var) {
-        plutovg_color_t color;
-        if(context->palette_func == NULL || !context->palette_func(context->closure, paint->id.data, paint->id.length, &color))
-            color = resolve_color(context, state->element, &paint->color);
-        plutovg_canvas_set_color(context->canvas, &color);
+        if(context->palette_func == NULL || !context->palette_func(context->closure, paint->id.data, paint->id.length, &out->color))
+            out->color = resolve_color(context, state, style_element(state->style, ATTR_COLOR), &paint->color);
         return true;
     }
 
     const element_t* ref = find_element(context->document, &paint->id);
     if(ref == NULL) {
-        plutovg_color_t color = resolve_color(context, state->element, &paint->color);
-        plutovg_canvas_set_color(context->canvas, &color);
+        out->color = resolve_color(context, state, style_element(state->style, ATTR_COLOR), &paint->color);
         return true;
     }
 
     if(ref->id == TAG_LINEAR_GRADIENT)
-        return apply_linear_gradient(state, context, ref);
+        return resolve_linear_gradient(state, context, ref, out, stops);
     if(ref->id == TAG_RADIAL_GRADIENT)
-        return apply_radial_gradient(state, context, ref);
+        return resolve_radial_gradient(state, context, ref, out, stops);
     return false;
 }
 
-static void draw_shape(const element_t* element, render_context_t* context, render_state_t* state)
+static void play_command(plutovg_canvas_t* canvas, const plutosvg_command_t* command, const plutovg_matrix_t* outer)
+{
+    const plutosvg_paint_t* paint = &command->paint;
+    switch(paint->type) {
+    case PLUTOSVG_PAINT_TYPE_COLOR:
+        plutovg_canvas_set_color(canvas, &paint->color);
+        break;
+    case PLUTOSVG_PAINT_TYPE_LINEAR_GRADIENT:
+        plutovg_canvas_set_linear_gradient(canvas, paint->values[0], paint->values[1], paint->values[2], paint->values[3],
+            paint->spread, paint->stops, paint->stop_count, &paint->matrix);
+        break;
+    case PLUTOSVG_PAINT_TYPE_RADIAL_GRADIENT:
+        plutovg_canvas_set_radial_gradient(canvas, paint->values[0], paint->values[1], paint->values[2], paint->values[3], paint->values[4], paint->values[5],
+            paint->spread, paint->stops, paint->stop_count, &paint->matrix);
+        break;
+    case PLUTOSVG_PAINT_TYPE_TEXTURE:
+        plutovg_canvas_set_texture(canvas, paint->texture, PLUTOVG_TEXTURE_TYPE_PLAIN, 1, &paint->matrix);
+        break;
+    }
+
+    plutovg_canvas_set_opacity(canvas, command->opacity);
+    if(outer) {
+        plutovg_matrix_t matrix;
+        plutovg_matrix_multiply(&matrix, &command->matrix, outer);
+        plutovg_canvas_set_matrix(canvas, &matrix);
+    } else {
+        plutovg_canvas_set_matrix(canvas, &command->matrix);
+    }
+
+    if(command->type == PLUTOSVG_COMMAND_TYPE_FILL) {
+        plutovg_canvas_set_fill_rule(canvas, command->fill_rule);
+        plutovg_canvas_fill_path(canvas, command->path);
+    } else {
+        plutovg_canvas_set_dash_offset(canvas, command->dash_offset);
+        plutovg_canvas_set_dash_array(canvas, command->dashes, command->dash_count);
+        plutovg_canvas_set_line_width(canvas, command->line_width);
+        plutovg_canvas_set_line_cap(canvas, command->line_cap);
+        plutovg_canvas_set_line_join(canvas, command->line_join);
+        plutovg_canvas_set_miter_limit(canvas, command->miter_limit);
+        plutovg_canvas_stroke_path(canvas, command->path);
+    }
+}
+
+static float stroke_extents_delta(float line_width, plutovg_line_cap_t line_cap, plutovg_line_join_t line_join, float miter_limit)
+{
+    float cap_limit = line_width / 2.f;
+    if(line_cap == PLUTOVG_LINE_CAP_SQUARE)
+        cap_limit *= PLUTOVG_SQRT2;
+    float join_limit = line_width / 2.f;
+    if(line_join == PLUTOVG_LINE_JOIN_MITER) {
+        join_limit *= miter_limit;
+    }
+
+    return MAX(cap_limit, join_limit);
+}
+
+/*
+ * Returns false when `extents`, grown by `delta` and mapped by `matrix`, cannot touch a pixel of the context's
+ * clip. The test allows a pixel of slack for anti-aliasing, so skipping such geometry never changes the output.
+ */
+static bool is_extents_visible(const render_context_t* context, const plutovg_matrix_t* matrix, const plutovg_rect_t* extents, float delta)
+{
+    if(IS_INVALID_RECT(context->clip) || IS_INVALID_RECT(*extents))
+        return true;
+    plutovg_rect_t rect = {extents->x - delta, extents->y - delta, extents->w + delta * 2.f, extents->h + delta * 2.f};
+    plutovg_matrix_map_rect(matrix, &rect, &rect);
+    return rect.x - 1.f < context->clip.x + context->clip.w && rect.x + rect.w + 1.f > context->clip.x
+        && rect.y - 1.f < context->clip.y + context->clip.h && rect.y + rect.h + 1.f > context->clip.y;
+}
+
+static plutovg_surface_t* copy_surface(const plutovg_surface_t* surface)
+{
+    int width = plutovg_surface_get_width(surface);
+    int height = plutovg_surface_get_height(surface);
+    plutovg_surface_t* copy = plutovg_surface_create(width, height);
+    if(copy == NULL)
+        return NULL;
+    const unsigned char* data = plutovg_surface_get_data(surface);
+    int stride = plutovg_surface_get_stride(surface);
+    unsigned char* copy_data = plutovg_surface_get_data(copy);
+    int copy_stride = plutovg_surface_get_stride(copy);
+    for(int y = 0; y < height; ++y) {
+        memcpy(copy_data + y * copy_stride, data + y * stride, width * 4);
+    }
+
+    return copy;
+}
+
+/*
+ * Appends a command to a display list. Paths and textures are copied rather than referenced, since the
+ * reference counts of objects shared with the document are not safe to update from concurrent calls.
+ * Allocation failures mark the list as failed rather than leaving it silently incomplete.
+ */
+static void display_list_add(plutosvg_display_list_t* list, const plutosvg_command_t* command)
+{
+    if(list->failed)
+        return;
+    if(list->count == list->capacity) {
+        int capacity = list->capacity == 0 ? 16 : list->capacity * 2;
+        plutosvg_command_t* commands = realloc(list->commands, capacity * sizeof(plutosvg_command_t));
+        if(commands == NULL) {
+            list->failed = true;
+            return;
+        }
+
+        list->commands = commands;
+        list->capacity = capacity;
+    }
+
+    plutosvg_command_t* copy = list->commands + list->count++;
+    *copy = *command;
+    copy->path = plutovg_path_clone(command->path);
+    copy->paint.texture = NULL;
+    if(copy->path == NULL) {
+        list->failed = true;
+        return;
+    }
+
+    if(command->paint.stop_count > 0) {
+        plutovg_gradient_stop_t* stops = arena_alloc(list->arena, command->paint.stop_count * sizeof(plutovg_gradient_stop_t));
+        memcpy(stops, command->paint.stops, command->paint.stop_count * sizeof(plutovg_gradient_stop_t));
+        copy->paint.stops = stops;
+    }
+
+    if(command->dash_count > 0) {
+        float* dashes = arena_alloc(list->arena, command->dash_count * sizeof(float));
+        memcpy(dashes, command->dashes, command->dash_count * sizeof(float));
+        copy->dashes = dashes;
+    }
+
+    if(command->paint.texture && (copy->paint.texture = copy_surface(command->paint.texture)) == NULL) {
+        list->failed = true;
+        return;
+    }
+
+    plutovg_rect_t extents;
+    plutovg_path_extents(copy->path, &extents, false);
+    if(copy->type == PLUTOSVG_COMMAND_TYPE_STROKE) {
+        float delta = stroke_extents_delta(copy->line_width, copy->line_cap, copy->line_join, copy->miter_limit);
+        extents.x -= delta;
+        extents.y -= delta;
+        extents.w += delta * 2.f;
+        extents.h += delta * 2.f;
+    }
+
+    plutovg_matrix_map_rect(&copy->matrix, &extents, &copy->extents);
+    if(list->count == 1) {
+        list->extents = copy->extents;
+        return;
+    }
+
+    float l = MIN(list->extents.x, copy->extents.x);
+    float t = MIN(list->extents.y, copy->extents.y);
+    float r = MAX(list->extents.x + list->extents.w, copy->extents.x + copy->extents.w);
+    float b = MAX(list->extents.y + list->extents.h, copy->extents.y + copy->extents.h);
+
+    list->extents.x = l;
+    list->extents.y = t;
+    list->extents.w = r - l;
+    list->extents.h = b - t;
+}
+
+static void emit_command(render_context_t* context, const plutosvg_command_t* command)
 {
-    paint_t stroke = {paint_type_none};
-    parse_paint(element, ATTR_STROKE, &stroke);
+    if(context->list) {
+        display_list_add(context->list, command);
+    } else {
+        play_command(context->canvas, command, NULL);
+    }
+}
 
+static void draw_shape(render_context_t* context, render_state_t* state, const plutovg_path_t* path, const paint_t* fill, const paint_t* stroke)
+{
+    const style_t* style = state->style;
     length_t stroke_width = {1.f, length_type_fixed};
     plutovg_line_cap_t line_cap = PLUTOVG_LINE_CAP_BUTT;
     plutovg_line_join_t line_join = PLUTOVG_LINE_JOIN_MITER;
     float miter_limit = 4.f;
 
-    if(stroke.type > paint_type_none) {
-        parse_length(element, ATTR_STROKE_WIDTH, &stroke_width, false, true);
-        parse_line_cap(element, ATTR_STROKE_LINECAP, &line_cap);
-        parse_line_join(element, ATTR_STROKE_LINEJOIN, &line_join);
-        parse_number(element, ATTR_STROKE_MITERLIMIT, &miter_limit, false, true);
+    if(stroke->type > paint_type_none) {
+        parse_length(style_element(style, ATTR_STROKE_WIDTH), ATTR_STROKE_WIDTH, &stroke_width, false, true);
+        parse_line_cap(style_element(style, ATTR_STROKE_LINECAP), ATTR_STROKE_LINECAP, &line_cap);
+        parse_line_join(style_element(style, ATTR_STROKE_LINEJOIN), ATTR_STROKE_LINEJOIN, &line_join);
+        parse_number(style_element(style, ATTR_STROKE_MITERLIMIT), ATTR_STROKE_MITERLIMIT, &miter_limit, false, true);
     }
 
     if(state->mode == render_mode_bounding) {
-        if(stroke.type == paint_type_none)
+        if(stroke->type == paint_type_none)
             return;
-        float line_width = resolve_length(state, &stroke_width, 'o');
-        float cap_limit = line_width / 2.f;
-        if(line_cap == PLUTOVG_LINE_CAP_SQUARE)
-            cap_limit *= PLUTOVG_SQRT2;
-        float join_limit = line_width / 2.f;
-        if(line_join == PLUTOVG_LINE_JOIN_MITER) {
-            join_limit *= miter_limit;
-        }
-
-        float delta = MAX(cap_limit, join_limit);
+        float delta = stroke_extents_delta(resolve_length(state, &stroke_width, 'o'), line_cap, line_join, miter_limit);
         state->extents.x -= delta;
         state->extents.y -= delta;
         state->extents.w += delta * 2.f;
@@ -1987,47 +5349,54 @@ static void draw_shape(const element_t* element, render_context_t* context, rend
         return;
     }
 
-    paint_t fill = {paint_type_color, {color_type_fixed, 0xFF000000}};
-    parse_paint(element, ATTR_FILL, &fill);
+    float stroke_delta = 0.f;
+    if(stroke->type > paint_type_none)
+        stroke_delta = stroke_extents_delta(resolve_length(state, &stroke_width, 'o'), line_cap, line_join, miter_limit);
+    if(!is_extents_visible(context, &state->matrix, &state->extents, stroke_delta)) {
+        return;
+    }
 
-    if(apply_paint(state, context, &fill)) {
+    gradient_stop_array_t stops;
+    plutosvg_command_t command = {0};
+    command.path = path;
+    command.matrix = state->matrix;
+    if(resolve_paint(state, context, fill, &command.paint, &stops)) {
         float fill_opacity = 1.f;
-        parse_number(element, ATTR_FILL_OPACITY, &fill_opacity, true, true);
-
-        plutovg_fill_rule_t fill_rule = PLUTOVG_FILL_RULE_NON_ZERO;
-        parse_fill_rule(element, ATTR_FILL_RULE, &fill_rule);
+        parse_number(style_element(style, ATTR_FILL_OPACITY), ATTR_FILL_OPACITY, &fill_opacity, true, true);
 
-        plutovg_canvas_set_fill_rule(context->canvas, fill_rule);
-        plutovg_canvas_set_opacity(context->canvas, fill_opacity * state->opacity);
-        plutovg_canvas_set_matrix(context->canvas, &state->matrix);
-        plutovg_canvas_fill_path(context->canvas, context->document->path);
+        command.type = PLUTOSVG_COMMAND_TYPE_FILL;
+        command.fill_rule = PLUTOVG_FILL_RULE_NON_ZERO;
+        parse_fill_rule(style_element(style, ATTR_FILL_RULE), ATTR_FILL_RULE, &command.fill_rule);
+        command.opacity = fill_opacity * state->opacity;
+        emit_command(context, &command);
     }
 
-    if(apply_paint(state, context, &stroke)) {
+    if(resolve_paint(state, context, stroke, &command.paint, &stops)) {
         float stroke_opacity = 1.f;
-        parse_number(element, ATTR_STROKE_OPACITY, &stroke_opacity, true, true);
+        parse_number(style_element(style, ATTR_STROKE_OPACITY), ATTR_STROKE_OPACITY, &stroke_opacity, true, true);
 
         length_t dash_offset = {0.f, length_type_fixed};
-        parse_length(element, ATTR_STROKE_DASHOFFSET, &dash_offset, false, true);
+        parse_length(style_element(style, ATTR_STROKE_DASHOFFSET), ATTR_STROKE_DASHOFFSET, &dash_offset, false, true);
 
         stroke_dash_array_t dash_array = {0};
-        parse_dash_array(element, ATTR_STROKE_DASHARRAY, &dash_array);
+        parse_dash_array(style_element(style, ATTR_STROKE_DASHARRAY), ATTR_STROKE_DASHARRAY, &dash_array);
 
         float dashes[MAX_DASHES];
         for(int i = 0; i < dash_array.size; ++i) {
             dashes[i] = resolve_length(state, dash_array.data + i, 'o');
         }
 
-        plutovg_canvas_set_dash_offset(context->canvas, resolve_length(state, &dash_offset, 'o'));
-        plutovg_canvas_set_dash_array(context->canvas, dashes, dash_array.size);
-
-        plutovg_canvas_set_line_width(context->canvas, resolve_length(state, &stroke_width, 'o'));
-        plutovg_canvas_set_line_cap(context->canvas, line_cap);
-        plutovg_canvas_set_line_join(context->canvas, line_join);
-        plutovg_canvas_set_miter_limit(context->canvas, miter_limit);
-        plutovg_canvas_set_opacity(context->canvas, stroke_opacity * state->opacity);
-        plutovg_canvas_set_matrix(context->canvas, &state->matrix);
-        plutovg_canvas_stroke_path(context->canvas, context->document->path);
+        command.type = PLUTOSVG_COMMAND_TYPE_STROKE;
+        command.fill_rule = PLUTOVG_FILL_RULE_NON_ZERO;
+        command.opacity = stroke_opacity * state->opacity;
+        command.line_width = resolve_length(state, &stroke_width, 'o');
+        command.line_cap = line_cap;
+        command.line_join = line_join;
+        command.miter_limit = miter_limit;
+        command.dash_offset = resolve_length(state, &dash_offset, 'o');
+        command.dashes = dashes;
+        command.dash_count = dash_array.size;
+        emit_command(context, &command);
     }
 }
 
@@ -2038,15 +5407,44 @@ static bool is_display_none(const element_t* element)
     return display == display_none;
 }
 
-static bool is_visibility_hidden(const element_t* element)
+static bool is_visibility_hidden(const render_state_t* state)
 {
     visibility_t visibility = visibility_visible;
-    parse_visibility(element, ATTR_VISIBILITY, &visibility);
+    parse_visibility(style_element(state->style, ATTR_VISIBILITY), ATTR_VISIBILITY, &visibility);
     return visibility != visibility_visible;
 }
 
+static bool is_transparent(const render_state_t* state)
+{
+    return state->mode == render_mode_painting && state->opacity <= 0.f;
+}
+
+/*
+ * Returns true when a shape, whose state has begun, paints nothing, so that its geometry need not be
+ * built; otherwise parses the paints that draw_shape uses. Bounding passes only skip hidden shapes, since
+ * the fill area of a shape counts towards its extents even when unpainted.
+ */
+static bool is_shape_hidden(const render_state_t* state, paint_t* fill, paint_t* stroke)
+{
+    const style_t* style = state->style;
+    if(is_visibility_hidden(state))
+        return true;
+    const paint_t black = {paint_type_color, {color_type_fixed, 0xFF000000}, {NULL, 0}};
+    const paint_t none = {paint_type_none, {color_type_fixed, 0}, {NULL, 0}};
+    *fill = black;
+    *stroke = none;
+    parse_paint(style_element(style, ATTR_STROKE), ATTR_STROKE, stroke);
+    if(state->mode != render_mode_painting)
+        return false;
+    if(is_transparent(state))
+        return true;
+    parse_paint(style_element(style, ATTR_FILL), ATTR_FILL, fill);
+    return fill->type == paint_type_none && stroke->type == paint_type_none;
+}
+
 static void render_element(const element_t* element, render_context_t* context, render_state_t* state);
 static void render_children(const element_t* element, render_context_t* context, render_state_t* state);
+static void render_group_children(const element_t* element, render_context_t* context, render_state_t* state);
 
 static void apply_view_transform(render_state_t* state, float width, float height)
 {
@@ -2116,13 +5514,13 @@ static void render_symbol(const element_t* element, render_context_t* context, r
     plutovg_matrix_translate(&new_state.matrix, x, y);
 
     apply_view_transform(&new_state, width, height);
-    render_children(element, context, &new_state);
+    render_group_children(element, context, &new_state);
     render_state_end(&new_state);
 }
 
 static void render_svg(const element_t* element, render_context_t* context, render_state_t* state)
 {
-    if(element->parent == NULL) {
+    if(resolve_parent_element(element, state) == NULL) {
         render_symbol(element, context, state, 0.f, 0.f, context->document->width, context->document->height);
         return;
     }
@@ -2147,9 +5545,14 @@ static void render_svg(const element_t* element, render_context_t* context, rend
 
 static void render_use(const element_t* element, render_context_t* context, render_state_t* state)
 {
-    if(is_display_none(element) || has_cycle_reference(state, element))
+    if(is_display_none(element))
+        return;
+    if(has_cycle_reference(state, element)) {
+        context->truncated = true;
         return;
-    element_t* ref = resolve_href(context->document, element);
+    }
+
+    const element_t* ref = resolve_href(context->document, element);
     if(ref == NULL)
         return;
     length_t x = {0, length_type_fixed};
@@ -2165,15 +5568,12 @@ static void render_use(const element_t* element, render_context_t* context, rend
     render_state_begin(element, &new_state, state);
     plutovg_matrix_translate(&new_state.matrix, _x, _y);
 
-    const element_t* parent = ref->parent;
-    ref->parent = (element_t*)(element);
     if(ref->id == TAG_SVG || ref->id == TAG_SYMBOL) {
         render_svg(ref, context, &new_state);
     } else {
         render_element(ref, context, &new_state);
     }
 
-    ref->parent = (element_t*)(parent);
     render_state_end(&new_state);
 }
 
@@ -2183,13 +5583,18 @@ static void render_g(const element_t* element, render_context_t* context, render
         return;
     render_state_t new_state;
     render_state_begin(element, &new_state, state);
-    render_children(element, context, &new_state);
+    render_group_children(element, context, &new_state);
     render_state_end(&new_state);
 }
 
 static void render_line(const element_t* element, render_context_t* context, render_state_t* state)
 {
-    if(is_display_none(element) || is_visibility_hidden(element))
+    if(is_display_none(element))
+        return;
+    render_state_t new_state;
+    render_state_begin(element, &new_state, state);
+    paint_t fill, stroke;
+    if(is_shape_hidden(&new_state, &fill, &stroke))
         return;
     length_t x1 = {0, length_type_fixed};
     length_t y1 = {0, length_type_fixed};
@@ -2206,24 +5611,26 @@ static void render_line(const element_t* element, render_context_t* context, ren
     float _x2 = resolve_length(state, &x2, 'x');
     float _y2 = resolve_length(state, &y2, 'y');
 
-    render_state_t new_state;
-    render_state_begin(element, &new_state, state);
-
     new_state.extents.x = MIN(_x1, _x2);
     new_state.extents.y = MIN(_y1, _y2);
     new_state.extents.w = fabsf(_x2 - _x1);
     new_state.extents.h = fabsf(_y2 - _y1);
 
-    plutovg_path_reset(context->document->path);
-    plutovg_path_move_to(context->document->path, _x1, _y1);
-    plutovg_path_line_to(context->document->path, _x2, _y2);
-    draw_shape(element, context, &new_state);
+    plutovg_path_reset(context->path);
+    plutovg_path_move_to(context->path, _x1, _y1);
+    plutovg_path_line_to(context->path, _x2, _y2);
+    draw_shape(context, &new_state, context->path, &fill, &stroke);
     render_state_end(&new_state);
 }
 
 static void render_ellipse(const element_t* element, render_context_t* context, render_state_t* state)
 {
-    if(is_display_none(element) || is_visibility_hidden(element))
+    if(is_display_none(element))
+        return;
+    render_state_t new_state;
+    render_state_begin(element, &new_state, state);
+    paint_t fill, stroke;
+    if(is_shape_hidden(&new_state, &fill, &stroke))
         return;
     length_t rx = {0, length_type_fixed};
     length_t ry = {0, length_type_fixed};
@@ -2240,26 +5647,28 @@ static void render_ellipse(const element_t* element, render_context_t* context,
 
     float _cx = resolve_length(state, &cx, 'x');
     float _cy = resolve_length(state, &cy, 'y');
-    float _rx = resolve_length(state, &rx, 'x');
-    float _ry = resolve_length(state, &ry, 'y');
-
-    render_state_t new_state;
-    render_state_begin(element, &new_state, state);
+    float _rx = resolve_length(state, &rx, 'x');
+    float _ry = resolve_length(state, &ry, 'y');
 
     new_state.extents.x = _cx - _rx;
     new_state.extents.y = _cy - _ry;
     new_state.extents.w = _rx + _rx;
     new_state.extents.h = _ry + _ry;
 
-    plutovg_path_reset(context->document->path);
-    plutovg_path_add_ellipse(context->document->path, _cx, _cy, _rx, _ry);
-    draw_shape(element, context, &new_state);
+    plutovg_path_reset(context->path);
+    plutovg_path_add_ellipse(context->path, _cx, _cy, _rx, _ry);
+    draw_shape(context, &new_state, context->path, &fill, &stroke);
     render_state_end(&new_state);
 }
 
 static void render_circle(const element_t* element, render_context_t* context, render_state_t* state)
 {
-    if(is_display_none(element) || is_visibility_hidden(element))
+    if(is_display_none(element))
+        return;
+    render_state_t new_state;
+    render_state_begin(element, &new_state, state);
+    paint_t fill, stroke;
+    if(is_shape_hidden(&new_state, &fill, &stroke))
         return;
     length_t r = {0, length_type_fixed};
     parse_length(element, ATTR_R, &r, false, false);
@@ -2275,23 +5684,25 @@ static void render_circle(const element_t* element, render_context_t* context, r
     float _cy = resolve_length(state, &cy, 'y');
     float _r = resolve_length(state, &r, 'o');
 
-    render_state_t new_state;
-    render_state_begin(element, &new_state, state);
-
     new_state.extents.x = _cx - _r;
     new_state.extents.y = _cy - _r;
     new_state.extents.w = _r + _r;
     new_state.extents.h = _r + _r;
 
-    plutovg_path_reset(context->document->path);
-    plutovg_path_add_circle(context->document->path, _cx, _cy, _r);
-    draw_shape(element, context, &new_state);
+    plutovg_path_reset(context->path);
+    plutovg_path_add_circle(context->path, _cx, _cy, _r);
+    draw_shape(context, &new_state, context->path, &fill, &stroke);
     render_state_end(&new_state);
 }
 
 static void render_rect(const element_t* element, render_context_t* context, render_state_t* state)
 {
-    if(is_display_none(element) || is_visibility_hidden(element))
+    if(is_display_none(element))
+        return;
+    render_state_t new_state;
+    render_state_begin(element, &new_state, state);
+    paint_t fill, stroke;
+    if(is_shape_hidden(&new_state, &fill, &stroke))
         return;
     length_t w = {0, length_type_fixed};
     length_t h = {0, length_type_fixed};
@@ -2323,45 +5734,44 @@ static void render_rect(const element_t* element, render_context_t* context, ren
     if(!is_length_valid(rx)) _rx = _ry;
     if(!is_length_valid(ry)) _ry = _rx;
 
-    render_state_t new_state;
-    render_state_begin(element, &new_state, state);
-
     new_state.extents.x = _x;
     new_state.extents.y = _y;
     new_state.extents.w = _w;
     new_state.extents.h = _h;
 
-    plutovg_path_reset(context->document->path);
-    plutovg_path_add_round_rect(context->document->path, _x, _y, _w, _h, _rx, _ry);
-    draw_shape(element, context, &new_state);
+    plutovg_path_reset(context->path);
+    plutovg_path_add_round_rect(context->path, _x, _y, _w, _h, _rx, _ry);
+    draw_shape(context, &new_state, context->path, &fill, &stroke);
     render_state_end(&new_state);
 }
 
 static void render_poly(const element_t* element, render_context_t* context, render_state_t* state)
 {
-    if(is_display_none(element) || is_visibility_hidden(element))
+    if(is_display_none(element))
         return;
     render_state_t new_state;
     render_state_begin(element, &new_state, state);
-
-    plutovg_path_reset(context->document->path);
-    parse_points(element, ATTR_POINTS, context->document->path);
-    plutovg_path_extents(context->document->path, &new_state.extents, false);
-    draw_shape(element, context, &new_state);
+    paint_t fill, stroke;
+    if(is_shape_hidden(&new_state, &fill, &stroke))
+        return;
+    const shape_t* shape = resolve_shape(context->document, element);
+    new_state.extents = shape->extents;
+    draw_shape(context, &new_state, shape->path, &fill, &stroke);
     render_state_end(&new_state);
 }
 
 static void render_path(const element_t* element, render_context_t* context, render_state_t* state)
 {
-    if(is_display_none(element) || is_visibility_hidden(element))
+    if(is_display_none(element))
         return;
     render_state_t new_state;
     render_state_begin(element, &new_state, state);
-
-    plutovg_path_reset(context->document->path);
-    parse_path(element, ATTR_D, context->document->path);
-    plutovg_path_extents(context->document->path, &new_state.extents, false);
-    draw_shape(element, context, &new_state);
+    paint_t fill, stroke;
+    if(is_shape_hidden(&new_state, &fill, &stroke))
+        return;
+    const shape_t* shape = resolve_shape(context->document, element);
+    new_state.extents = shape->extents;
+    draw_shape(context, &new_state, shape->path, &fill, &stroke);
     render_state_end(&new_state);
 }
 
@@ -2468,15 +5878,128 @@ static plutovg_surface_t* load_image(const element_t* element)
     return NULL;
 }
 
+static image_entry_t* image_cache_find(image_cache_t* cache, const element_t* element)
+{
+    image_entry_t** it = &cache->entries;
+    while(*it) {
+        image_entry_t* entry = *it;
+        if(entry->element == element) {
+            *it = entry->next;
+            entry->next = cache->entries;
+            cache->entries = entry;
+            return entry;
+        }
+
+        it = &entry->next;
+    }
+
+    return NULL;
+}
+
+static void image_cache_add(image_cache_t* cache, const element_t* element, plutovg_surface_t* surface, int width, int height, int reduction)
+{
+    image_entry_t* entry = image_cache_find(cache, element);
+    if(entry == NULL) {
+        entry = malloc(sizeof(image_entry_t));
+        entry->element = element;
+        entry->next = cache->entries;
+        cache->entries = entry;
+    } else {
+        plutovg_surface_destroy(entry->surface);
+    }
+
+    entry->surface = plutovg_surface_reference(surface);
+    entry->width = width;
+    entry->height = height;
+    entry->reduction = reduction;
+    entry->size = (size_t)(plutovg_surface_get_stride(surface)) * plutovg_surface_get_height(surface);
+    image_cache_trim(cache);
+}
+
+#define MAX_IMAGE_REDUCTION 8
+
+static int compute_image_reduction(const plutovg_matrix_t* matrix, float scale_x, float scale_y)
+{
+    float device_scale_x = fabsf(scale_x) * sqrtf(matrix->a * matrix->a + matrix->b * matrix->b);
+    float device_scale_y = fabsf(scale_y) * sqrtf(matrix->c * matrix->c + matrix->d * matrix->d);
+    float device_scale = MAX(device_scale_x, device_scale_y);
+
+    int reduction = 1;
+    while(reduction < MAX_IMAGE_REDUCTION && device_scale * reduction * 2.f <= 1.f)
+        reduction *= 2;
+    return reduction;
+}
+
+static plutovg_surface_t* reduce_image(plutovg_surface_t* image, int reduction)
+{
+    int width = plutovg_surface_get_width(image);
+    int height = plutovg_surface_get_height(image);
+    int stride = plutovg_surface_get_stride(image);
+    const unsigned char* data = plutovg_surface_get_data(image);
+
+    int reduced_width = (width + reduction - 1) / reduction;
+    int reduced_height = (height + reduction - 1) / reduction;
+    plutovg_surface_t* surface = plutovg_surface_create(reduced_width, reduced_height);
+    if(surface == NULL)
+        return NULL;
+    int reduced_stride = plutovg_surface_get_stride(surface);
+    unsigned char* reduced_data = plutovg_surface_get_data(surface);
+    for(int y = 0; y < reduced_height; ++y) {
+        int y0 = y * reduction;
+        int y1 = MIN(y0 + reduction, height);
+        for(int x = 0; x < reduced_width; ++x) {
+            int x0 = x * reduction;
+            int x1 = MIN(x0 + reduction, width);
+            uint32_t sum[4] = {0, 0, 0, 0};
+            for(int v = y0; v < y1; ++v) {
+                const unsigned char* pixel = data + v * stride + x0 * 4;
+                for(int u = x0; u < x1; ++u) {
+                    sum[0] += pixel[0];
+                    sum[1] += pixel[1];
+                    sum[2] += pixel[2];
+                    sum[3] += pixel[3];
+                    pixel += 4;
+                }
+            }
+
+            uint32_t count = (x1 - x0) * (y1 - y0);
+            unsigned char* pixel = reduced_data + y * reduced_stride + x * 4;
+            pixel[0] = (sum[0] + count / 2) / count;
+            pixel[1] = (sum[1] + count / 2) / count;
+            pixel[2] = (sum[2] + count / 2) / count;
+            pixel[3] = (sum[3] + count / 2) / count;
+        }
+    }
+
+    return surface;
+}
+
 static void draw_image(const element_t* element, render_context_t* context, render_state_t* state, float x, float y, float width, float height)
 {
-    if(state->mode == render_mode_bounding)
+    if(state->mode == render_mode_bounding || !is_extents_visible(context, &state->matrix, &state->extents, 0.f))
         return;
-    plutovg_surface_t* image = load_image(element);
-    if(image == NULL)
-        return;
-    float image_width = plutovg_surface_get_width(image);
-    float image_height = plutovg_surface_get_height(image);
+    image_cache_t* cache = context->document->image_cache;
+    mutex_lock(&cache->lock);
+    image_entry_t* entry = image_cache_find(cache, element);
+
+    plutovg_surface_t* image;
+    int image_width, image_height, reduction;
+    if(entry == NULL) {
+        image = load_image(element);
+        if(image == NULL) {
+            mutex_unlock(&cache->lock);
+            return;
+        }
+
+        image_width = plutovg_surface_get_width(image);
+        image_height = plutovg_surface_get_height(image);
+        reduction = 1;
+    } else {
+        image = plutovg_surface_reference(entry->surface);
+        image_width = entry->width;
+        image_height = entry->height;
+        reduction = entry->reduction;
+    }
 
     plutovg_rect_t dst_rect = {x, y, width, height};
     plutovg_rect_t src_rect = {0, 0, image_width, image_height};
@@ -2487,20 +6010,75 @@ static void draw_image(const element_t* element, render_context_t* context, rend
 
     float scale_x = dst_rect.w / src_rect.w;
     float scale_y = dst_rect.h / src_rect.h;
-    plutovg_matrix_t matrix = {scale_x, 0, 0, scale_y, -src_rect.x * scale_x, -src_rect.y * scale_y};
-
-    plutovg_canvas_set_fill_rule(context->canvas, PLUTOVG_FILL_RULE_NON_ZERO);
-    plutovg_canvas_set_opacity(context->canvas, state->opacity);
-    plutovg_canvas_set_matrix(context->canvas, &state->matrix);
-    plutovg_canvas_translate(context->canvas, dst_rect.x, dst_rect.y);
-    plutovg_canvas_set_texture(context->canvas, image, PLUTOVG_TEXTURE_TYPE_PLAIN, 1, &matrix);
-    plutovg_canvas_fill_rect(context->canvas, 0, 0, dst_rect.w, dst_rect.h);
+
+    bool modified = entry == NULL;
+    if((context->document->flags & PLUTOSVG_LOAD_FLAGS_REDUCE_IMAGES) || (context->list && reduction > 1)) {
+        int required_reduction = context->list ? 1 : compute_image_reduction(&state->matrix, scale_x, scale_y);
+        if(reduction > required_reduction) {
+            plutovg_surface_destroy(image);
+            image = load_image(element);
+            if(image == NULL) {
+                mutex_unlock(&cache->lock);
+                return;
+            }
+
+            reduction = 1;
+            modified = true;
+        }
+
+        if(reduction == 1 && required_reduction > 1) {
+            plutovg_surface_t* reduced_image = reduce_image(image, required_reduction);
+            if(reduced_image) {
+                plutovg_surface_destroy(image);
+                image = reduced_image;
+                reduction = required_reduction;
+                modified = true;
+            }
+        }
+    }
+
+    if(modified)
+        image_cache_add(cache, element, image, image_width, image_height, reduction);
+    float reduction_x = (float)(image_width) / plutovg_surface_get_width(image);
+    float reduction_y = (float)(image_height) / plutovg_surface_get_height(image);
+
+    /*
+     * Draw through a private surface over the cached pixels, so the canvas never updates the reference
+     * count of a surface that other threads may be using; our reference keeps the pixels alive.
+     */
+    plutovg_surface_t* texture = plutovg_surface_create_for_data(plutovg_surface_get_data(image),
+        plutovg_surface_get_width(image), plutovg_surface_get_height(image), plutovg_surface_get_stride(image));
+    mutex_unlock(&cache->lock);
+
+    plutosvg_command_t command = {0};
+    command.type = PLUTOSVG_COMMAND_TYPE_FILL;
+    command.path = context->path;
+    command.paint.type = PLUTOSVG_PAINT_TYPE_TEXTURE;
+    command.paint.texture = texture;
+    plutovg_matrix_init(&command.paint.matrix, scale_x * reduction_x, 0, 0, scale_y * reduction_y, -src_rect.x * scale_x, -src_rect.y * scale_y);
+    command.matrix = state->matrix;
+    plutovg_matrix_translate(&command.matrix, dst_rect.x, dst_rect.y);
+    command.opacity = state->opacity;
+    command.fill_rule = PLUTOVG_FILL_RULE_NON_ZERO;
+
+    plutovg_path_reset(context->path);
+    plutovg_path_add_rect(context->path, 0, 0, dst_rect.w, dst_rect.h);
+    if(texture)
+        emit_command(context, &command);
+    plutovg_surface_destroy(texture);
+
+    mutex_lock(&cache->lock);
     plutovg_surface_destroy(image);
+    mutex_unlock(&cache->lock);
 }
 
 static void render_image(const element_t* element, render_context_t* context, render_state_t* state)
 {
-    if(is_display_none(element) || is_visibility_hidden(element))
+    if(is_display_none(element))
+        return;
+    render_state_t new_state;
+    render_state_begin(element, &new_state, state);
+    if(is_visibility_hidden(&new_state) || is_transparent(&new_state))
         return;
     length_t w = {0, length_type_fixed};
     length_t h = {0, length_type_fixed};
@@ -2520,9 +6098,6 @@ static void render_image(const element_t* element, render_context_t* context, re
     float _w = resolve_length(state, &w, 'x');
     float _h = resolve_length(state, &h, 'y');
 
-    render_state_t new_state;
-    render_state_begin(element, &new_state, state);
-
     new_state.extents.x = _x;
     new_state.extents.y = _y;
     new_state.extents.w = _w;
@@ -2533,6 +6108,8 @@ static void render_image(const element_t* element, render_context_t* context, re
 
 static void render_element(const element_t* element, render_context_t* context, render_state_t* state)
 {
+    if(!materialize_element(context->document, element))
+        return;
     switch(element->id) {
     case TAG_SVG:
         render_svg(element, context, state);
@@ -2572,72 +6149,348 @@ static void render_element(const element_t* element, render_context_t* context,
 
 static void render_children(const element_t* element, render_context_t* context, render_state_t* state)
 {
-    if(context->depth < MAX_RENDER_DEPTH) {
-        const element_t* child = element->first_child;
-        while(child) {
-            context->depth++;
-            render_element(child, context, state);
-            context->depth--;
-            child = child->next_sibling;
+    if(context->depth >= MAX_RENDER_DEPTH) {
+        context->truncated = true;
+        return;
+    }
+
+    const element_t* child = element_first_child(element);
+    while(child) {
+        context->depth++;
+        render_element(child, context, state);
+        context->depth--;
+        child = element_next_sibling(child);
+    }
+}
+
+static bounds_slot_t* element_bounds_slot(const plutosvg_document_t* document, const element_t* element)
+{
+    return document->bounds_slots + (element - document->elements);
+}
+
+static void store_children_bounds(const plutosvg_document_t* document, const element_t* element, float view_width, float view_height, const plutovg_rect_t* bounds)
+{
+    bounds_slot_t* slot = element_bounds_slot(document, element);
+    mutex_lock(&document->lock);
+    if(slot->children == NULL) {
+        bounds_entry_t* entry = arena_alloc(document->arena, sizeof(bounds_entry_t));
+        entry->view_width = view_width;
+        entry->view_height = view_height;
+        entry->bounds = *bounds;
+        atomic_store_ptr(&slot->children, entry);
+    }
+
+    mutex_unlock(&document->lock);
+}
+
+static void store_extents(const plutosvg_document_t* document, const element_t* element, const plutovg_rect_t* extents)
+{
+    bounds_slot_t* slot = element_bounds_slot(document, element);
+    mutex_lock(&document->lock);
+    if(slot->extents == NULL) {
+        plutovg_rect_t* entry = arena_alloc(document->arena, sizeof(plutovg_rect_t));
+        *entry = *extents;
+        atomic_store_ptr(&slot->extents, entry);
+    }
+
+    mutex_unlock(&document->lock);
+}
+
+/*
+ * Renders the children of a container. A painting pass skips the subtree when it is fully transparent or
+ * when its bounds miss the clip. The bounds come from a bounding pass in the container's own user space,
+ * run once per container and viewport size and kept on the document; only containers rendered with the
+ * style computed at load time are measured, since the bounds under a <use> element depend on the style it
+ * passes down. Bounds of subtrees that were cut short by a reference cycle or the depth limit depend on the
+ * path that reached them and are not kept.
+ */
+static void render_group_children(const element_t* element, render_context_t* context, render_state_t* state)
+{
+    if(state->mode == render_mode_painting) {
+        if(state->opacity <= 0.f)
+            return;
+        if(context->cull_groups && state->style == element->style) {
+            render_state_t bounding_state = *state;
+            bounding_state.mode = render_mode_bounding;
+            bounding_state.extents = INVALID_RECT;
+            render_group_children(element, context, &bounding_state);
+            if(!is_extents_visible(context, &state->matrix, &bounding_state.extents, 0.f)) {
+                return;
+            }
+        }
+
+        render_children(element, context, state);
+        return;
+    }
+
+    const bool measured = state->style == element->style;
+    if(measured) {
+        const bounds_entry_t* entry = atomic_load_ptr(&element_bounds_slot(context->document, element)->children);
+        if(entry && entry->view_width == state->view_width && entry->view_height == state->view_height) {
+            state->extents = entry->bounds;
+            return;
         }
     }
+
+    bool truncated = context->truncated;
+    context->truncated = false;
+    render_children(element, context, state);
+    if(measured && !context->truncated)
+        store_children_bounds(context->document, element, state->view_width, state->view_height, &state->extents);
+    context->truncated = context->truncated || truncated;
 }
 
-bool plutosvg_document_render(const plutosvg_document_t* document, const char* id, plutovg_canvas_t* canvas, const plutovg_color_t* current_color, plutosvg_palette_func_t palette_func, void* closure)
+const plutosvg_element_t* plutosvg_document_find(const plutosvg_document_t* document, const char* name, int length)
+{
+    if(length == -1)
+        length = strlen(name);
+    if(length < 0)
+        return NULL;
+    const string_t id = {name, length};
+    bool locked = document_begin_read(document);
+    const element_t* element = find_element(document, &id);
+    document_end_read(document, locked);
+    return element;
+}
+
+/*
+ * Returns true when an element is known to lie within `clip` under `matrix`, because its extents have
+ * been measured already or, for the root element, because its viewport does. Measuring each container
+ * against the clip would then cost a bounding pass over the subtree and skip nothing.
+ */
+static bool is_known_inside_clip(const plutosvg_document_t* document, const element_t* element, const plutovg_matrix_t* matrix, const plutovg_rect_t* clip)
+{
+    plutovg_rect_t rect;
+    const plutovg_rect_t* extents = atomic_load_ptr(&element_bounds_slot(document, element)->extents);
+    if(extents) {
+        rect = *extents;
+    } else if(element == document->root_element) {
+        rect = PLUTOVG_MAKE_RECT(0, 0, document->width, document->height);
+    } else {
+        return false;
+    }
+
+    plutovg_matrix_map_rect(matrix, &rect, &rect);
+    return rect.x >= clip->x && rect.y >= clip->y && rect.x + rect.w <= clip->x + clip->w && rect.y + rect.h <= clip->y + clip->h;
+}
+
+/*
+ * Renders onto `canvas`, skipping shapes, images and containers whose device bounds miss `clip`; pass INVALID_RECT to draw everything.
+ * Containers are only measured when the element may reach outside the clip.
+ */
+static void render_to_canvas(const plutosvg_document_t* document, const plutosvg_element_t* element, plutovg_canvas_t* canvas,
+    const plutovg_color_t* current_color, plutosvg_palette_func_t palette_func, void* closure, plutovg_rect_t clip)
 {
+    bool locked = document_begin_read(document);
+
     render_state_t state;
     state.parent = NULL;
+    state.element = element ? element : document->root_element;
+    state.style = state.element->style;
     state.mode = render_mode_painting;
     state.opacity = 1.f;
     state.extents = INVALID_RECT;
     state.view_width = document->width;
     state.view_height = document->height;
     plutovg_canvas_get_matrix(canvas, &state.matrix);
-    if(id == NULL) {
-        state.element = document->root_element;
-    } else {
-        const string_t name = {id, strlen(id)};
-        const element_t* element = find_element(document, &name);
-        if(element == NULL)
-            return false;
-        state.element = element;
-    }
 
-    render_context_t context = {document, canvas, current_color, palette_func, closure, 0};
+    render_context_t context = {document, canvas, current_color, palette_func, closure, 0, NULL, plutovg_path_create(), clip, false, false};
+    context.cull_groups = !IS_INVALID_RECT(clip) && !is_known_inside_clip(document, state.element, &state.matrix, &clip);
     render_element(state.element, &context, &state);
+    document_end_read(document, locked);
+    plutovg_path_destroy(context.path);
+}
+
+bool plutosvg_document_render_element(const plutosvg_document_t* document, const plutosvg_element_t* element, plutovg_canvas_t* canvas, const plutovg_color_t* current_color, plutosvg_palette_func_t palette_func, void* closure)
+{
+    const plutovg_surface_t* surface = plutovg_canvas_get_surface(canvas);
+    plutovg_rect_t clip = {0, 0, plutovg_surface_get_width(surface), plutovg_surface_get_height(surface)};
+    render_to_canvas(document, element, canvas, current_color, palette_func, closure, clip);
     return true;
 }
 
-plutovg_surface_t* plutosvg_document_render_to_surface(const plutosvg_document_t* document, const char* id, int width, int height, const plutovg_color_t* current_color, plutosvg_palette_func_t palette_func, void* closure)
+bool plutosvg_document_render(const plutosvg_document_t* document, const char* id, plutovg_canvas_t* canvas, const plutovg_color_t* current_color, plutosvg_palette_func_t palette_func, void* closure)
 {
-    plutovg_rect_t extents = {0, 0, document->width, document->height};
-    if(id && !plutosvg_document_extents(document, id, &extents))
-        return NULL;
-    if(extents.w <= 0.f || extents.h <= 0.f)
+    const plutosvg_element_t* element = NULL;
+    if(id && (element = plutosvg_document_find(document, id, -1)) == NULL)
+        return false;
+    return plutosvg_document_render_element(document, element, canvas, current_color, palette_func, closure);
+}
+
+/*
+ * Creates the surface for rendering an element to a surface, and computes the extents of the element it maps onto.
+ */
+static plutovg_surface_t* create_element_surface(const plutosvg_document_t* document, const plutosvg_element_t* element, int width, int height, plutovg_rect_t* extents)
+{
+    *extents = PLUTOVG_MAKE_RECT(0, 0, document->width, document->height);
+    if(element)
+        plutosvg_document_element_extents(document, element, extents);
+    if(extents->w <= 0.f || extents->h <= 0.f)
         return NULL;
     if(width <= 0 && height <= 0) {
-        width = (int)(ceilf(extents.w));
-        height = (int)(ceilf(extents.h));
+        width = (int)(ceilf(extents->w));
+        height = (int)(ceilf(extents->h));
     } else if(width > 0 && height <= 0) {
-        height = (int)(ceilf(width * extents.h / extents.w));
+        height = (int)(ceilf(width * extents->h / extents->w));
     } else if(height > 0 && width <= 0) {
-        width = (int)(ceilf(height * extents.w / extents.h));
+        width = (int)(ceilf(height * extents->w / extents->h));
     }
 
-    plutovg_surface_t* surface = plutovg_surface_create(width, height);
+    return plutovg_surface_create(width, height);
+}
+
+plutovg_surface_t* plutosvg_document_render_element_to_surface(const plutosvg_document_t* document, const plutosvg_element_t* element, int width, int height, const plutovg_color_t* current_color, plutosvg_palette_func_t palette_func, void* closure)
+{
+    plutovg_rect_t extents;
+    plutovg_surface_t* surface = create_element_surface(document, element, width, height, &extents);
     if(surface == NULL)
         return NULL;
+    width = plutovg_surface_get_width(surface);
+    height = plutovg_surface_get_height(surface);
+
     plutovg_canvas_t* canvas = plutovg_canvas_create(surface);
     plutovg_canvas_scale(canvas, width / extents.w, height / extents.h);
     plutovg_canvas_translate(canvas, -extents.x, -extents.y);
-    if(!plutosvg_document_render(document, id, canvas, current_color, palette_func, closure)) {
-        plutovg_canvas_destroy(canvas);
+    plutosvg_document_render_element(document, element, canvas, current_color, palette_func, closure);
+    plutovg_canvas_destroy(canvas);
+    return surface;
+}
+
+#if defined(PLUTOSVG_HAS_THREADS)
+
+#define MAX_RENDER_TASKS 64
+
+typedef struct {
+    const plutosvg_document_t* document;
+    const plutosvg_element_t* element;
+    const plutovg_color_t* current_color;
+    plutosvg_palette_func_t palette_func;
+    void* closure;
+    plutovg_surface_t* surface;
+    plutovg_rect_t extents;
+    int y;
+    int height;
+    bool success;
+    bool threaded;
+    thread_t thread;
+} render_task_t;
+
+/*
+ * Renders the rows [y, y + height) of the shared surface. The canvas covers the rows above the band as
+ * well and clips to the band, so every pixel is rasterized with exactly the matrix a serial render uses;
+ * starting the canvas at the band would change the rounding of every device coordinate. The price is
+ * that a shape crossing several bands is scan converted from the top of the surface by each of them, so
+ * only the culled shapes and the blending outside the band are saved.
+ */
+static void render_task_run(void* closure)
+{
+    render_task_t* task = closure;
+    int width = plutovg_surface_get_width(task->surface);
+    int height = plutovg_surface_get_height(task->surface);
+    plutovg_surface_t* surface = plutovg_surface_create_for_data(plutovg_surface_get_data(task->surface),
+        width, task->y + task->height, plutovg_surface_get_stride(task->surface));
+    if(surface == NULL) {
+        task->success = false;
+        return;
+    }
+
+    plutovg_canvas_t* canvas = plutovg_canvas_create(surface);
+    plutovg_canvas_clip_rect(canvas, 0, task->y, width, task->height);
+    plutovg_canvas_scale(canvas, width / task->extents.w, height / task->extents.h);
+    plutovg_canvas_translate(canvas, -task->extents.x, -task->extents.y);
+
+    plutovg_rect_t clip = {0, task->y, width, task->height};
+    render_to_canvas(task->document, task->element, canvas, task->current_color, task->palette_func, task->closure, clip);
+    plutovg_canvas_destroy(canvas);
+    plutovg_surface_destroy(surface);
+    task->success = true;
+}
+
+#endif
+
+plutovg_surface_t* plutosvg_document_render_element_to_surface_with_threads(const plutosvg_document_t* document, const plutosvg_element_t* element, int width, int height,
+    const plutovg_color_t* current_color, plutosvg_palette_func_t palette_func, void* closure, int threads)
+{
+#if defined(PLUTOSVG_HAS_THREADS)
+    if(threads <= 0)
+        threads = thread_count();
+    threads = MIN(threads, MAX_RENDER_TASKS);
+    if(threads < 2)
+        return plutosvg_document_render_element_to_surface(document, element, width, height, current_color, palette_func, closure);
+    plutovg_rect_t extents;
+    plutovg_surface_t* surface = create_element_surface(document, element, width, height, &extents);
+    if(surface == NULL)
+        return NULL;
+    height = plutovg_surface_get_height(surface);
+    threads = MIN(threads, height);
+
+    render_task_t tasks[MAX_RENDER_TASKS];
+    for(int i = 0; i < threads; ++i) {
+        render_task_t* task = tasks + i;
+        task->document = document;
+        task->element = element;
+        task->current_color = current_color;
+        task->palette_func = palette_func;
+        task->closure = closure;
+        task->surface = surface;
+        task->extents = extents;
+        task->y = (int)((int64_t)(height) * i / threads);
+        task->height = (int)((int64_t)(height) * (i + 1) / threads) - task->y;
+        task->success = false;
+        task->threaded = false;
+    }
+
+    for(int i = 1; i < threads; ++i) {
+        tasks[i].threaded = thread_start(&tasks[i].thread, render_task_run, tasks + i);
+    }
+
+    render_task_run(tasks);
+    bool success = tasks[0].success;
+    for(int i = 1; i < threads; ++i) {
+        if(tasks[i].threaded) {
+            thread_join(&tasks[i].thread);
+        } else {
+            render_task_run(tasks + i);
+        }
+
+        success = success && tasks[i].success;
+    }
+
+    if(!success) {
         plutovg_surface_destroy(surface);
         return NULL;
     }
 
-    plutovg_canvas_destroy(canvas);
     return surface;
+#else
+    (void)(threads);
+    return plutosvg_document_render_element_to_surface(document, element, width, height, current_color, palette_func, closure);
+#endif
+}
+
+plutovg_surface_t* plutosvg_document_render_to_surface(const plutosvg_document_t* document, const char* id, int width, int height, const plutovg_color_t* current_color, plutosvg_palette_func_t palette_func, void* closure)
+{
+    const plutosvg_element_t* element = NULL;
+    if(id && (element = plutosvg_document_find(document, id, -1)) == NULL)
+        return NULL;
+    return plutosvg_document_render_element_to_surface(document, element, width, height, current_color, palette_func, closure);
+}
+
+plutovg_surface_t* plutosvg_document_render_to_surface_with_threads(const plutosvg_document_t* document, const char* id, int width, int height,
+    const plutovg_color_t* current_color, plutosvg_palette_func_t palette_func, void* closure, int threads)
+{
+    const plutosvg_element_t* element = NULL;
+    if(id && (element = plutosvg_document_find(document, id, -1)) == NULL)
+        return NULL;
+    return plutosvg_document_render_element_to_surface_with_threads(document, element, width, height, current_color, palette_func, closure, threads);
+}
+
+void plutosvg_document_set_image_cache_limit(plutosvg_document_t* document, size_t limit)
+{
+    mutex_lock(&document->image_cache->lock);
+    document->image_cache->limit = limit;
+    image_cache_trim(document->image_cache);
+    mutex_unlock(&document->image_cache->lock);
 }
 
 float plutosvg_document_get_width(const plutosvg_document_t* document)
@@ -2650,40 +6503,157 @@ float plutosvg_document_get_height(const plutosvg_document_t* document)
     return document->height;
 }
 
-bool plutosvg_document_extents(const plutosvg_document_t* document, const char* id, plutovg_rect_t* extents)
+int plutosvg_document_get_pruned_count(const plutosvg_document_t* document)
 {
+    return (int)(document->pruned_count);
+}
+
+/*
+ * The extents of an element depend only on the element, as it is measured in the context of its own
+ * ancestors, so they are computed once and kept in the element's bounds slot.
+ */
+bool plutosvg_document_element_extents(const plutosvg_document_t* document, const plutosvg_element_t* element, plutovg_rect_t* extents)
+{
+    if(element == NULL)
+        element = document->root_element;
+    const plutovg_rect_t* cached = atomic_load_ptr(&element_bounds_slot(document, element)->extents);
+    if(cached) {
+        *extents = *cached;
+        return true;
+    }
+
+    bool locked = document_begin_read(document);
+
     render_state_t state;
     state.parent = NULL;
+    state.element = element;
+    state.style = state.element->style;
     state.mode = render_mode_bounding;
     state.opacity = 1.f;
     state.extents = INVALID_RECT;
     state.view_width = document->width;
     state.view_height = document->height;
     plutovg_matrix_init_identity(&state.matrix);
-    if(id == NULL) {
-        state.element = document->root_element;
-    } else {
-        const string_t name = {id, strlen(id)};
-        const element_t* element = find_element(document, &name);
-        if(element == NULL) {
-            *extents = EMPTY_RECT;
-            return false;
-        }
-
-        state.element = element;
-    }
 
-    render_context_t context = {document, NULL, NULL, NULL, NULL, 0};
+    render_context_t context = {document, NULL, NULL, NULL, NULL, 0, NULL, plutovg_path_create(), INVALID_RECT, false, false};
     render_element(state.element, &context, &state);
+    document_end_read(document, locked);
+    plutovg_path_destroy(context.path);
     if(IS_INVALID_RECT(state.extents)) {
         *extents = EMPTY_RECT;
     } else {
         *extents = state.extents;
     }
 
+    store_extents(document, element, extents);
     return true;
 }
 
+bool plutosvg_document_extents(const plutosvg_document_t* document, const char* id, plutovg_rect_t* extents)
+{
+    const plutosvg_element_t* element = NULL;
+    if(id && (element = plutosvg_document_find(document, id, -1)) == NULL) {
+        *extents = EMPTY_RECT;
+        return false;
+    }
+
+    return plutosvg_document_element_extents(document, element, extents);
+}
+
+plutosvg_display_list_t* plutosvg_document_compile_element(const plutosvg_document_t* document, const plutosvg_element_t* element, const plutosvg_compile_options_t* options)
+{
+    plutosvg_display_list_t* list = malloc(sizeof(plutosvg_display_list_t));
+    if(list == NULL)
+        return NULL;
+    list->arena = arena_create(0, false);
+    if(list->arena == NULL) {
+        free(list);
+        return NULL;
+    }
+
+    list->commands = NULL;
+    list->count = 0;
+    list->capacity = 0;
+    list->extents = EMPTY_RECT;
+    list->failed = false;
+
+    bool locked = document_begin_read(document);
+
+    render_state_t state;
+    state.parent = NULL;
+    state.element = element ? element : document->root_element;
+    state.style = state.element->style;
+    state.mode = render_mode_painting;
+    state.opacity = 1.f;
+    state.extents = INVALID_RECT;
+    state.view_width = document->width;
+    state.view_height = document->height;
+    plutovg_matrix_init_identity(&state.matrix);
+
+    render_context_t context = {document, NULL, NULL, NULL, NULL, 0, list, plutovg_path_create(), INVALID_RECT, false, false};
+    if(options) {
+        context.current_color = options->current_color;
+        context.palette_func = options->palette_func;
+        context.closure = options->closure;
+    }
+
+    render_element(state.element, &context, &state);
+    document_end_read(document, locked);
+    plutovg_path_destroy(context.path);
+    if(list->failed) {
+        plutosvg_display_list_destroy(list);
+        return NULL;
+    }
+
+    return list;
+}
+
+plutosvg_display_list_t* plutosvg_document_compile(const plutosvg_document_t* document, const char* id, const plutosvg_compile_options_t* options)
+{
+    const plutosvg_element_t* element = NULL;
+    if(id && (element = plutosvg_document_find(document, id, -1)) == NULL)
+        return NULL;
+    return plutosvg_document_compile_element(document, element, options);
+}
+
+void plutosvg_display_list_render(const plutosvg_display_list_t* list, plutovg_canvas_t* canvas)
+{
+    plutovg_matrix_t matrix;
+    plutovg_canvas_get_matrix(canvas, &matrix);
+    for(int i = 0; i < list->count; ++i) {
+        play_command(canvas, list->commands + i, &matrix);
+    }
+}
+
+int plutosvg_display_list_get_count(const plutosvg_display_list_t* list)
+{
+    return list->count;
+}
+
+const plutosvg_command_t* plutosvg_display_list_get_commands(const plutosvg_display_list_t* list)
+{
+    return list->commands;
+}
+
+void plutosvg_display_list_get_extents(const plutosvg_display_list_t* list, plutovg_rect_t* extents)
+{
+    *extents = list->extents;
+}
+
+void plutosvg_display_list_destroy(plutosvg_display_list_t* list)
+{
+    if(list == NULL)
+        return;
+    for(int i = 0; i < list->count; ++i) {
+        plutovg_path_destroy((plutovg_path_t*)(list->commands[i].path));
+        plutovg_surface_destroy(list->commands[i].paint.texture);
+    }
+
+    plutosvg_arena_destroy(list->arena);
+    free(list->commands);
+    free(list);
+}
+
 #ifdef PLUTOSVG_HAS_FREETYPE
 
 #include "plutosvg-ft.h"
@@ -72,6 +72,16 @@ PLUTOSVG_API const char* plutosvg_version_string(void);
 
 /**
  * @brief Represents an abstract SVG document handle.
+ *
+ * When PlutoSVG is built with thread support, the functions that take a `const plutosvg_document_t*`
+ * may be called on the same document from several threads at once, each with its own canvas. Rendering
+ * only reads the document, except that path geometry and measured bounds are stored the first time they
+ * are needed, so concurrent renders do not wait on each other once a document has been rendered. Documents
+ * loaded with `PLUTOSVG_LOAD_FLAGS_LAZY` are safe to share as well, but such calls on them run one at a time
+ * until every child of the root element has been parsed.
+ * Loading, destroying and `plutosvg_document_set_image_cache_limit` must not overlap with other calls.
+ * Documents that share an arena may be rendered concurrently as well, but none of them may be loaded or
+ * destroyed, nor the arena reset, while another is in use.
  */
 typedef struct plutosvg_document plutosvg_document_t;
 
@@ -112,6 +122,383 @@ PLUTOSVG_API plutosvg_document_t* plutosvg_document_load_from_data(const char* d
  */
 PLUTOSVG_API plutosvg_document_t* plutosvg_document_load_from_file(const char* filename, float width, float height);
 
+/**
+ * @brief Computes the intrinsic size of an SVG document without loading it.
+ *
+ * Parsing stops after the start tag of the root `<svg>` element, and the size is resolved with the same
+ * rules as the loaders. Errors after that tag are not detected, so a document that probes successfully
+ * may still fail to load.
+ *
+ * @param data Pointer to the SVG data buffer.
+ * @param length Length of the data buffer, or `-1` if `data` is null-terminated.
+ * @param width Container width used to resolve the intrinsic width, or `-1` if unspecified.
+ * @param height Container height used to resolve the intrinsic height, or `-1` if unspecified.
+ * @param intrinsic_width Receives the intrinsic width. Can be `NULL`.
+ * @param intrinsic_height Receives the intrinsic height. Can be `NULL`.
+ * @param view_box Receives the `viewBox` of the root element, or an empty rectangle if it has none. Can be `NULL`.
+ * @return `true` if the size was resolved; `false` if the data does not start with a valid root `<svg>` element
+ * or its size is not positive.
+ */
+PLUTOSVG_API bool plutosvg_probe_size(const char* data, int length, float width, float height,
+    float* intrinsic_width, float* intrinsic_height, plutovg_rect_t* view_box);
+
+/**
+ * @brief Flags controlling how an SVG document is loaded.
+ */
+typedef enum plutosvg_load_flags {
+    PLUTOSVG_LOAD_FLAGS_NONE = 0, ///< Default loading behavior.
+    PLUTOSVG_LOAD_FLAGS_SEQUENTIAL = 1 << 0, ///< Hint that the file is read sequentially while parsing.
+    PLUTOSVG_LOAD_FLAGS_COMPILE = 1 << 1, ///< Parse attribute values once at load time instead of on every render.
+    PLUTOSVG_LOAD_FLAGS_BUILD_PATHS = 1 << 2, ///< Build path and polyline geometry at load time instead of on first use.
+    PLUTOSVG_LOAD_FLAGS_REDUCE_IMAGES = 1 << 3, ///< Keep embedded images at a reduced resolution when they are drawn much smaller than their native size.
+    PLUTOSVG_LOAD_FLAGS_LAZY = 1 << 4, ///< Parse each child of the root element on first use instead of at load time. A child whose source then fails to parse is not rendered, measured or found by id, and saving the document compiled fails. Ignored by `plutosvg_parser_create`.
+    PLUTOSVG_LOAD_FLAGS_OWN_DATA = 1 << 5, ///< Copy the attribute values the document keeps, so the source can be released as soon as loading returns. Overrides `PLUTOSVG_LOAD_FLAGS_LAZY`.
+    PLUTOSVG_LOAD_FLAGS_PRUNE = 1 << 6, ///< Remove elements that can never be drawn when rendering the whole document. Overrides `PLUTOSVG_LOAD_FLAGS_LAZY`.
+    PLUTOSVG_LOAD_FLAGS_PARALLEL = 1 << 7 ///< Parse the children of the root element of large documents on several threads. Ignored with `PLUTOSVG_LOAD_FLAGS_LAZY`, by `plutosvg_parser_create`, and when built without thread support.
+} plutosvg_load_flags_t;
+
+/**
+ * @brief Loads an SVG document from a file using the specified load flags.
+ *
+ * The file is memory-mapped when the platform supports it, so the document references the file contents
+ * directly without copying them. The mapping is released when the document is destroyed, or before this function
+ * returns with `PLUTOSVG_LOAD_FLAGS_OWN_DATA`. If the file cannot be mapped, it is read into memory instead.
+ *
+ * @param filename Path to the SVG file.
+ * @param width Container width used to resolve the intrinsic width, or `-1` if unspecified.
+ * @param height Container height used to resolve the intrinsic height, or `-1` if unspecified.
+ * @param flags Bitwise combination of `plutosvg_load_flags_t` values.
+ * @return Pointer to the loaded `plutosvg_document_t` object, or `NULL` if loading fails.
+ */
+PLUTOSVG_API plutosvg_document_t* plutosvg_document_load_from_file_with_flags(const char* filename, float width, float height, int flags);
+
+/**
+ * @brief Loads an SVG document from a data buffer using the specified load flags.
+ *
+ * @note The buffer pointed to by `data` must remain valid until the returned `plutosvg_document_t` object is destroyed,
+ * unless `flags` includes `PLUTOSVG_LOAD_FLAGS_OWN_DATA`. In that case `destroy_func` is called before this function
+ * returns and the buffer may be released right away.
+ *
+ * @param data Pointer to the SVG data buffer.
+ * @param length Length of the data buffer, or `-1` if `data` is null-terminated.
+ * @param width Container width used to resolve the intrinsic width, or `-1` if unspecified.
+ * @param height Container height used to resolve the intrinsic height, or `-1` if unspecified.
+ * @param flags Bitwise combination of `plutosvg_load_flags_t` values.
+ * @param destroy_func Custom function called when the document is destroyed.
+ * @param closure User-defined data passed to the `destroy_func` callback.
+ * @return Pointer to the loaded `plutosvg_document_t` object, or `NULL` if loading fails.
+ */
+PLUTOSVG_API plutosvg_document_t* plutosvg_document_load_from_data_with_flags(const char* data, int length, float width, float height, int flags,
+    plutovg_destroy_func_t destroy_func, void* closure);
+
+/**
+ * @brief Represents a memory arena that holds the nodes and attributes of loaded documents.
+ */
+typedef struct plutosvg_arena plutosvg_arena_t;
+
+/**
+ * @brief Creates a memory arena.
+ *
+ * The arena allocates memory in blocks that grow geometrically, starting from `size` bytes.
+ * An arena can be shared by documents loaded with `plutosvg_document_load_from_data_with_arena` or
+ * `plutosvg_document_load_from_file_with_arena`, and reset for reuse once all of them are destroyed.
+ * Rendering allocates from the arena of a document, so an arena created here locks on every allocation
+ * and its documents may be rendered on different threads at once.
+ *
+ * @param size Initial block size in bytes, or `0` to use the default.
+ * @return Pointer to the newly created `plutosvg_arena_t` object, or `NULL` on failure.
+ */
+PLUTOSVG_API plutosvg_arena_t* plutosvg_arena_create(size_t size);
+
+/**
+ * @brief Releases all allocations made from an arena while keeping its blocks for reuse.
+ *
+ * @note Every document loaded into the arena must be destroyed before the arena is reset.
+ *
+ * @param arena Pointer to the arena.
+ */
+PLUTOSVG_API void plutosvg_arena_reset(plutosvg_arena_t* arena);
+
+/**
+ * @brief Destroys an arena and frees all of its memory.
+ *
+ * @note Every document loaded into the arena must be destroyed before the arena is destroyed.
+ *
+ * @param arena Pointer to the arena. If `NULL`, the function does nothing.
+ */
+PLUTOSVG_API void plutosvg_arena_destroy(plutosvg_arena_t* arena);
+
+/**
+ * @brief Loads an SVG document from a file, allocating its nodes from the given arena.
+ *
+ * Behaves like `plutosvg_document_load_from_file_with_flags`. The document does not take ownership of the arena.
+ *
+ * @param filename Path to the SVG file.
+ * @param width Container width used to resolve the intrinsic width, or `-1` if unspecified.
+ * @param height Container height used to resolve the intrinsic height, or `-1` if unspecified.
+ * @param flags Bitwise combination of `plutosvg_load_flags_t` values.
+ * @param arena Arena to allocate from, or `NULL` to give the document its own arena.
+ * @return Pointer to the loaded `plutosvg_document_t` object, or `NULL` if loading fails.
+ */
+PLUTOSVG_API plutosvg_document_t* plutosvg_document_load_from_file_with_arena(const char* filename, float width, float height, int flags, plutosvg_arena_t* arena);
+
+/**
+ * @brief Loads an SVG document from a data buffer, allocating its nodes from the given arena.
+ *
+ * Behaves like `plutosvg_document_load_from_data_with_flags`. The document does not take ownership of the arena.
+ *
+ * @param data Pointer to the SVG data buffer.
+ * @param length Length of the data buffer, or `-1` if `data` is null-terminated.
+ * @param width Container width used to resolve the intrinsic width, or `-1` if unspecified.
+ * @param height Container height used to resolve the intrinsic height, or `-1` if unspecified.
+ * @param flags Bitwise combination of `plutosvg_load_flags_t` values.
+ * @param arena Arena to allocate from, or `NULL` to give the document its own arena.
+ * @param destroy_func Custom function called when the document is destroyed.
+ * @param closure User-defined data passed to the `destroy_func` callback.
+ * @return Pointer to the loaded `plutosvg_document_t` object, or `NULL` if loading fails.
+ */
+PLUTOSVG_API plutosvg_document_t* plutosvg_document_load_from_data_with_arena(const char* data, int length, float width, float height, int flags,
+    plutosvg_arena_t* arena, plutovg_destroy_func_t destroy_func, void* closure);
+
+/**
+ * @brief Saves an SVG document in the compiled binary format.
+ *
+ * The compiled format stores the element tree, its attributes, the parsed geometry of path and polyline
+ * elements and the id index in a position-independent layout that can be loaded without parsing any XML.
+ * It is little-endian on every host, so data written on one machine loads on any other. Loading still
+ * builds the element array and the path geometry of the document; only attribute values and ids are
+ * used in place.
+ *
+ * @param document Pointer to the SVG document.
+ * @param filename Path of the file to write.
+ * @return `true` if the file was written successfully; `false` otherwise.
+ */
+PLUTOSVG_API bool plutosvg_document_save_compiled(const plutosvg_document_t* document, const char* filename);
+
+/**
+ * @brief Writes an SVG document in the compiled binary format to a user-defined stream.
+ *
+ * @param document Pointer to the SVG document.
+ * @param write_func Callback function that receives the compiled data.
+ * @param closure User-defined data passed to the `write_func` callback.
+ * @return `true` if the document was compiled successfully; `false` otherwise.
+ */
+PLUTOSVG_API bool plutosvg_document_write_compiled(const plutosvg_document_t* document, plutovg_write_func_t write_func, void* closure);
+
+/**
+ * @brief Loads an SVG document from compiled binary data.
+ *
+ * @note The buffer pointed to by `data` must be 4-byte aligned and remain valid until the returned `plutosvg_document_t` object is destroyed,
+ * unless `flags` includes `PLUTOSVG_LOAD_FLAGS_OWN_DATA`.
+ *
+ * @param data Pointer to the compiled data, as written by `plutosvg_document_save_compiled`.
+ * @param length Length of the compiled data in bytes.
+ * @param width Container width used to resolve the intrinsic width, or `-1` if unspecified.
+ * @param height Container height used to resolve the intrinsic height, or `-1` if unspecified.
+ * @param flags Bitwise combination of `plutosvg_load_flags_t` values.
+ * @param destroy_func Custom function called when the document is destroyed.
+ * @param closure User-defined data passed to the `destroy_func` callback.
+ * @return Pointer to the loaded `plutosvg_document_t` object, or `NULL` if the data is not a valid compiled document.
+ */
+PLUTOSVG_API plutosvg_document_t* plutosvg_document_load_compiled_from_data(const void* data, size_t length, float width, float height, int flags,
+    plutovg_destroy_func_t destroy_func, void* closure);
+
+/**
+ * @brief Loads an SVG document from a compiled binary file.
+ *
+ * The file is memory-mapped and used in place until the document is destroyed. Where it cannot be mapped,
+ * it is read into memory instead.
+ *
+ * @param filename Path to the compiled file, as written by `plutosvg_document_save_compiled`.
+ * @param width Container width used to resolve the intrinsic width, or `-1` if unspecified.
+ * @param height Container height used to resolve the intrinsic height, or `-1` if unspecified.
+ * @param flags Bitwise combination of `plutosvg_load_flags_t` values.
+ * @return Pointer to the loaded `plutosvg_document_t` object, or `NULL` if loading fails.
+ */
+PLUTOSVG_API plutosvg_document_t* plutosvg_document_load_compiled_from_file(const char* filename, float width, float height, int flags);
+
+/**
+ * @brief Represents a file that packs many compiled SVG documents behind a name index.
+ */
+typedef struct plutosvg_bundle plutosvg_bundle_t;
+
+/**
+ * @brief Saves several SVG documents into a single bundle file.
+ *
+ * @param filename Path of the file to write.
+ * @param documents Array of `count` documents to store.
+ * @param names Array of `count` unique null-terminated names used to look the documents up.
+ * @param count Number of documents.
+ * @return `true` if the file was written successfully; `false` otherwise.
+ */
+PLUTOSVG_API bool plutosvg_bundle_save(const char* filename, const plutosvg_document_t* const documents[], const char* const names[], int count);
+
+/**
+ * @brief Opens a bundle file.
+ *
+ * The file is memory-mapped and stays mapped while the bundle or any document loaded from it is alive. Where
+ * it cannot be mapped, it is read into memory instead.
+ *
+ * @param filename Path to the bundle file, as written by `plutosvg_bundle_save`.
+ * @return Pointer to the opened `plutosvg_bundle_t` object, or `NULL` if the file is not a valid bundle.
+ */
+PLUTOSVG_API plutosvg_bundle_t* plutosvg_bundle_open(const char* filename);
+
+/**
+ * @brief Returns the number of documents in a bundle.
+ *
+ * @param bundle Pointer to the bundle.
+ * @return The number of documents in the bundle.
+ */
+PLUTOSVG_API int plutosvg_bundle_get_count(const plutosvg_bundle_t* bundle);
+
+/**
+ * @brief Returns the name of a document in a bundle.
+ *
+ * Names are sorted in byte order and are not null-terminated.
+ *
+ * @param bundle Pointer to the bundle.
+ * @param index Index of the document, between `0` and `plutosvg_bundle_get_count() - 1`.
+ * @param length Pointer to store the length of the name, or `NULL`.
+ * @return Pointer to the name, or `NULL` if `index` is out of range.
+ */
+PLUTOSVG_API const char* plutosvg_bundle_get_name(const plutosvg_bundle_t* bundle, int index, int* length);
+
+/**
+ * @brief Loads a document from a bundle by name.
+ *
+ * @param bundle Pointer to the bundle.
+ * @param name Null-terminated name of the document.
+ * @param width Container width used to resolve the intrinsic width, or `-1` if unspecified.
+ * @param height Container height used to resolve the intrinsic height, or `-1` if unspecified.
+ * @param flags Bitwise combination of `plutosvg_load_flags_t` values.
+ * @return Pointer to the loaded `plutosvg_document_t` object, or `NULL` if no document has that name or loading fails.
+ */
+PLUTOSVG_API plutosvg_document_t* plutosvg_bundle_load(plutosvg_bundle_t* bundle, const char* name, float width, float height, int flags);
+
+/**
+ * @brief Releases a bundle.
+ *
+ * Documents loaded from the bundle remain valid; the file is unmapped once the last of them is destroyed.
+ *
+ * @param bundle Pointer to the bundle. If `NULL`, the function does nothing.
+ */
+PLUTOSVG_API void plutosvg_bundle_destroy(plutosvg_bundle_t* bundle);
+
+/**
+ * @brief Represents an incremental SVG parser handle.
+ */
+typedef struct plutosvg_parser plutosvg_parser_t;
+
+/**
+ * @brief Creates a parser that builds an SVG document from data supplied in chunks.
+ *
+ * Unlike `plutosvg_document_load_from_data`, the input does not need to be kept alive: the parser copies the
+ * parts of each chunk that the document retains.
+ *
+ * @param width Container width used to resolve the intrinsic width, or `-1` if unspecified.
+ * @param height Container height used to resolve the intrinsic height, or `-1` if unspecified.
+ * @param flags Bitwise combination of `plutosvg_load_flags_t` values.
+ * @return Pointer to the newly created `plutosvg_parser_t` object, or `NULL` on failure.
+ */
+PLUTOSVG_API plutosvg_parser_t* plutosvg_parser_create(float width, float height, int flags);
+
+/**
+ * @brief Feeds the next chunk of SVG data to a parser.
+ *
+ * Chunks may be split at any byte offset. The chunk can be released as soon as this function returns.
+ *
+ * @param parser Pointer to the parser.
+ * @param data Pointer to the chunk data.
+ * @param length Length of the chunk data.
+ * @return `true` if the data was accepted; `false` if the document is malformed or memory allocation failed.
+ */
+PLUTOSVG_API bool plutosvg_parser_feed(plutosvg_parser_t* parser, const char* data, size_t length);
+
+/**
+ * @brief Completes parsing and returns the resulting SVG document.
+ *
+ * The caller owns the returned document. The parser must still be released with `plutosvg_parser_destroy`.
+ *
+ * @param parser Pointer to the parser.
+ * @return Pointer to the loaded `plutosvg_document_t` object, or `NULL` if loading fails.
+ */
+PLUTOSVG_API plutosvg_document_t* plutosvg_parser_finish(plutosvg_parser_t* parser);
+
+/**
+ * @brief Destroys a parser and frees any partially parsed document.
+ *
+ * @param parser Pointer to the parser to destroy.
+ */
+PLUTOSVG_API void plutosvg_parser_destroy(plutosvg_parser_t* parser);
+
+/**
+ * @brief An opaque handle to an element of an SVG document.
+ *
+ * Handles are owned by their document and remain valid until it is destroyed.
+ */
+typedef struct plutosvg_element plutosvg_element_t;
+
+/**
+ * @brief Finds an element of an SVG document by its ID.
+ *
+ * Resolving the handle once and passing it to the `_element` variants of the render and
+ * extents functions avoids measuring and hashing the ID on every call.
+ *
+ * @param document Pointer to the SVG document.
+ * @param name ID of the element to find.
+ * @param length Length of the ID, or `-1` if it is null-terminated.
+ * @return Handle to the element, or `NULL` if no element has the given ID.
+ */
+PLUTOSVG_API const plutosvg_element_t* plutosvg_document_find(const plutosvg_document_t* document, const char* name, int length);
+
+/**
+ * @brief Renders an SVG document or a specific element onto a canvas.
+ *
+ * Elements and groups that fall outside the canvas surface are skipped, as are shapes with no fill, no
+ * stroke or zero opacity. Groups are only measured when the element may reach outside the surface, that
+ * is when its extents are not known to fit (for the entire document, when its viewport does not fit); the
+ * bounds of each group are then computed on first use and kept by the document.
+ *
+ * @param document Pointer to the SVG document.
+ * @param element Handle of the element to render, or `NULL` to render the entire document.
+ * @param canvas Canvas onto which the SVG element or document will be rendered.
+ * @param current_color Color used to resolve CSS `currentColor` values.
+ * @param palette_func Callback function for resolving CSS color variables.
+ * @param closure User-defined data passed to the `palette_func` callback.
+ * @return `true` if rendering was successful; `false` otherwise.
+ */
+PLUTOSVG_API bool plutosvg_document_render_element(const plutosvg_document_t* document, const plutosvg_element_t* element, plutovg_canvas_t* canvas,
+    const plutovg_color_t* current_color, plutosvg_palette_func_t palette_func, void* closure);
+
+/**
+ * @brief Renders an SVG document or a specific element to a surface.
+ *
+ * @param document Pointer to the SVG document.
+ * @param element Handle of the element to render, or `NULL` to render the entire document.
+ * @param width Expected width of the surface, or `-1` if unspecified.
+ * @param height Expected height of the surface, or `-1` if unspecified.
+ * @param current_color Color used to resolve CSS `currentColor` values.
+ * @param palette_func Callback function for resolving CSS color variables.
+ * @param closure User-defined data passed to the `palette_func` callback.
+ * @return Pointer to the rendered `plutovg_surface_t` object, or `NULL` if rendering fails.
+ */
+PLUTOSVG_API plutovg_surface_t* plutosvg_document_render_element_to_surface(const plutosvg_document_t* document, const plutosvg_element_t* element, int width, int height,
+    const plutovg_color_t* current_color, plutosvg_palette_func_t palette_func, void* closure);
+
+/**
+ * @brief Retrieves the bounding box of a specific element or the entire SVG document.
+ *
+ * The extents of each element are computed on the first call and kept by the document, so later calls
+ * for the same element return without measuring it again.
+ *
+ * @param document Pointer to the SVG document.
+ * @param element Handle of the element whose extents to retrieve, or `NULL` to retrieve the extents of the entire document.
+ * @param extents Pointer to a `plutovg_rect_t` object where the extents will be stored.
+ * @return `true` if the extents were successfully retrieved; `false` otherwise.
+ */
+PLUTOSVG_API bool plutosvg_document_element_extents(const plutosvg_document_t* document, const plutosvg_element_t* element, plutovg_rect_t* extents);
+
 /**
  * @brief Renders an SVG document or a specific element onto a canvas.
  *
@@ -141,6 +528,44 @@ PLUTOSVG_API bool plutosvg_document_render(const plutosvg_document_t* document,
 PLUTOSVG_API plutovg_surface_t* plutosvg_document_render_to_surface(const plutosvg_document_t* document, const char* id, int width, int height,
     const plutovg_color_t* current_color, plutosvg_palette_func_t palette_func, void* closure);
 
+/**
+ * @brief Renders an SVG document or a specific element to a surface using several threads.
+ *
+ * The surface is split into horizontal bands that are rendered concurrently, each skipping the shapes that
+ * fall outside its band. The result is identical to `plutosvg_document_render_element_to_surface`.
+ * A shape that spans several bands is still scan converted by each of them, so documents made of a few
+ * large shapes gain little; the speedup comes from many small shapes spread over the surface.
+ * Without thread support, or when `threads` is 1, the element is rendered on the calling thread.
+ *
+ * @param document Pointer to the SVG document.
+ * @param element Handle of the element to render, or `NULL` to render the entire document.
+ * @param width Expected width of the surface, or `-1` if unspecified.
+ * @param height Expected height of the surface, or `-1` if unspecified.
+ * @param current_color Color used to resolve CSS `currentColor` values.
+ * @param palette_func Callback function for resolving CSS color variables; it may be called from several threads.
+ * @param closure User-defined data passed to the `palette_func` callback.
+ * @param threads Number of threads to use, or `0` to use one per processor.
+ * @return Pointer to the rendered `plutovg_surface_t` object, or `NULL` if rendering fails.
+ */
+PLUTOSVG_API plutovg_surface_t* plutosvg_document_render_element_to_surface_with_threads(const plutosvg_document_t* document, const plutosvg_element_t* element,
+    int width, int height, const plutovg_color_t* current_color, plutosvg_palette_func_t palette_func, void* closure, int threads);
+
+/**
+ * @brief Renders an SVG document or a specific element to a surface using several threads.
+ *
+ * @param document Pointer to the SVG document.
+ * @param id ID of the SVG element to render, or `NULL` to render the entire document.
+ * @param width Expected width of the surface, or `-1` if unspecified.
+ * @param height Expected height of the surface, or `-1` if unspecified.
+ * @param current_color Color used to resolve CSS `currentColor` values.
+ * @param palette_func Callback function for resolving CSS color variables; it may be called from several threads.
+ * @param closure User-defined data passed to the `palette_func` callback.
+ * @param threads Number of threads to use, or `0` to use one per processor.
+ * @return Pointer to the rendered `plutovg_surface_t` object, or `NULL` if rendering fails.
+ */
+PLUTOSVG_API plutovg_surface_t* plutosvg_document_render_to_surface_with_threads(const plutosvg_document_t* document, const char* id, int width, int height,
+    const plutovg_color_t* current_color, plutosvg_palette_func_t palette_func, void* closure, int threads);
+
 /**
  * @brief Returns the intrinsic width of the SVG document.
  *
@@ -157,6 +582,30 @@ PLUTOSVG_API float plutosvg_document_get_width(const plutosvg_document_t* docume
  */
 PLUTOSVG_API float plutosvg_document_get_height(const plutosvg_document_t* document);
 
+/**
+ * @brief Returns the number of elements removed by `PLUTOSVG_LOAD_FLAGS_PRUNE`.
+ *
+ * Pruning removes `display="none"` subtrees, shapes with a zero size, `use` elements without a target and
+ * content outside the drawn tree that no `href` or paint `url()` refers to. Removed elements can no longer
+ * be found or rendered by id.
+ *
+ * @param document Pointer to the SVG document.
+ * @return The number of removed elements, or 0 if the document was not pruned.
+ */
+PLUTOSVG_API int plutosvg_document_get_pruned_count(const plutosvg_document_t* document);
+
+/**
+ * @brief Sets the maximum amount of memory used to cache decoded images.
+ *
+ * Embedded images are decoded on first render and kept on the document for later renders.
+ * When the cached images exceed `limit` bytes, the least recently drawn ones are released.
+ * The default limit is `SIZE_MAX`; a limit of `0` disables the cache.
+ *
+ * @param document Pointer to the SVG document.
+ * @param limit Maximum size in bytes of the decoded images kept by the document.
+ */
+PLUTOSVG_API void plutosvg_document_set_image_cache_limit(plutosvg_document_t* document, size_t limit);
+
 /**
  * @brief Retrieves the bounding box of a specific element or the entire SVG document.
  *
@@ -169,6 +618,141 @@ PLUTOSVG_API float plutosvg_document_get_height(const plutosvg_document_t* docum
  */
 PLUTOSVG_API bool plutosvg_document_extents(const plutosvg_document_t* document, const char* id, plutovg_rect_t* extents);
 
+/**
+ * @brief Kinds of paint a display list command can draw with.
+ */
+typedef enum plutosvg_paint_type {
+    PLUTOSVG_PAINT_TYPE_COLOR, ///< A solid color.
+    PLUTOSVG_PAINT_TYPE_LINEAR_GRADIENT, ///< A linear gradient from (`values[0]`, `values[1]`) to (`values[2]`, `values[3]`).
+    PLUTOSVG_PAINT_TYPE_RADIAL_GRADIENT, ///< A radial gradient with center (`values[0]`, `values[1]`), radius `values[2]`, focal point (`values[3]`, `values[4]`) and focal radius `values[5]`.
+    PLUTOSVG_PAINT_TYPE_TEXTURE ///< An image surface.
+} plutosvg_paint_type_t;
+
+/**
+ * @brief A paint resolved at compile time.
+ */
+typedef struct plutosvg_paint {
+    plutosvg_paint_type_t type; ///< Kind of paint.
+    plutovg_color_t color; ///< Color, for `PLUTOSVG_PAINT_TYPE_COLOR`.
+    float values[6]; ///< Gradient geometry, as described by `plutosvg_paint_type_t`.
+    plutovg_spread_method_t spread; ///< Gradient spread method.
+    const plutovg_gradient_stop_t* stops; ///< Gradient stops.
+    int stop_count; ///< Number of gradient stops.
+    plutovg_matrix_t matrix; ///< Gradient or texture transform.
+    plutovg_surface_t* texture; ///< Image surface, for `PLUTOSVG_PAINT_TYPE_TEXTURE`.
+} plutosvg_paint_t;
+
+/**
+ * @brief Kinds of display list commands.
+ */
+typedef enum plutosvg_command_type {
+    PLUTOSVG_COMMAND_TYPE_FILL, ///< Fills `path`.
+    PLUTOSVG_COMMAND_TYPE_STROKE ///< Strokes `path`.
+} plutosvg_command_type_t;
+
+/**
+ * @brief A single draw command of a display list.
+ */
+typedef struct plutosvg_command {
+    plutosvg_command_type_t type; ///< Whether the path is filled or stroked.
+    const plutovg_path_t* path; ///< Path to draw, in the coordinates of `matrix`.
+    plutosvg_paint_t paint; ///< Paint to draw with.
+    plutovg_matrix_t matrix; ///< Transform from path coordinates to the user space of the compiled element.
+    float opacity; ///< Opacity, including the opacity of the ancestors.
+    plutovg_fill_rule_t fill_rule; ///< Fill rule, for `PLUTOSVG_COMMAND_TYPE_FILL`.
+    float line_width; ///< Stroke width.
+    plutovg_line_cap_t line_cap; ///< Stroke line cap.
+    plutovg_line_join_t line_join; ///< Stroke line join.
+    float miter_limit; ///< Stroke miter limit.
+    float dash_offset; ///< Stroke dash offset.
+    const float* dashes; ///< Stroke dash array.
+    int dash_count; ///< Number of entries in `dashes`.
+    plutovg_rect_t extents; ///< Bounds of the drawn area in user space, including the stroke.
+} plutosvg_command_t;
+
+/**
+ * @brief Options used when compiling a display list.
+ */
+typedef struct plutosvg_compile_options {
+    const plutovg_color_t* current_color; ///< Color used to resolve CSS `currentColor` values.
+    plutosvg_palette_func_t palette_func; ///< Callback function for resolving CSS color variables.
+    void* closure; ///< User-defined data passed to the `palette_func` callback.
+} plutosvg_compile_options_t;
+
+/**
+ * @brief Represents a flat list of draw commands recorded from an SVG document.
+ */
+typedef struct plutosvg_display_list plutosvg_display_list_t;
+
+/**
+ * @brief Records the draw commands of an SVG document or a specific element.
+ *
+ * Styles, paints and lengths are resolved once, so the list can be replayed without walking the document again.
+ * Colors are resolved with the given options; compile again if they change.
+ * The list holds its own references to paths and images and stays valid after the document is destroyed.
+ *
+ * @param document Pointer to the SVG document.
+ * @param element Handle of the element to compile, or `NULL` to compile the entire document.
+ * @param options Options used to resolve colors, or `NULL` for the defaults.
+ * @return Pointer to the display list, or `NULL` on failure.
+ */
+PLUTOSVG_API plutosvg_display_list_t* plutosvg_document_compile_element(const plutosvg_document_t* document, const plutosvg_element_t* element,
+    const plutosvg_compile_options_t* options);
+
+/**
+ * @brief Records the draw commands of an SVG document or a specific element.
+ *
+ * @param document Pointer to the SVG document.
+ * @param id ID of the SVG element to compile, or `NULL` to compile the entire document.
+ * @param options Options used to resolve colors, or `NULL` for the defaults.
+ * @return Pointer to the display list, or `NULL` if the element was not found or compiling failed.
+ */
+PLUTOSVG_API plutosvg_display_list_t* plutosvg_document_compile(const plutosvg_document_t* document, const char* id, const plutosvg_compile_options_t* options);
+
+/**
+ * @brief Draws a display list onto a canvas.
+ *
+ * The current matrix of the canvas is applied on top of each command's matrix, as with `plutosvg_document_render`.
+ * Under a matrix other than the identity, the pixels may differ from a direct render by rounding.
+ *
+ * @param list Pointer to the display list.
+ * @param canvas Canvas onto which the list will be drawn.
+ */
+PLUTOSVG_API void plutosvg_display_list_render(const plutosvg_display_list_t* list, plutovg_canvas_t* canvas);
+
+/**
+ * @brief Returns the number of commands in a display list.
+ *
+ * @param list Pointer to the display list.
+ * @return The number of commands.
+ */
+PLUTOSVG_API int plutosvg_display_list_get_count(const plutosvg_display_list_t* list);
+
+/**
+ * @brief Returns the commands of a display list.
+ *
+ * The commands are stored contiguously in drawing order and remain owned by the list.
+ *
+ * @param list Pointer to the display list.
+ * @return Pointer to the first of `plutosvg_display_list_get_count` commands.
+ */
+PLUTOSVG_API const plutosvg_command_t* plutosvg_display_list_get_commands(const plutosvg_display_list_t* list);
+
+/**
+ * @brief Retrieves the union of the extents of all commands in a display list.
+ *
+ * @param list Pointer to the display list.
+ * @param extents Pointer to a `plutovg_rect_t` object where the extents will be stored.
+ */
+PLUTOSVG_API void plutosvg_display_list_get_extents(const plutosvg_display_list_t* list, plutovg_rect_t* extents);
+
+/**
+ * @brief Destroys a display list and releases its references.
+ *
+ * @param list Pointer to the display list.
+ */
+PLUTOSVG_API void plutosvg_display_list_destroy(plutosvg_display_list_t* list);
+
 /**
  * @brief Destroys an SVG document and frees its resources.
  *